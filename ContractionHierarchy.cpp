@@ -0,0 +1,614 @@
+#include "provided.h"
+#include "support.h"
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <limits>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+using namespace std;
+
+typedef pair<double, int> QueueEntry;
+typedef priority_queue<QueueEntry, vector<QueueEntry>, greater<QueueEntry>> MinQueue;
+
+class ContractionHierarchyImpl
+{
+public:
+	ContractionHierarchyImpl(const StreetMap* sm);
+	~ContractionHierarchyImpl();
+	void build();
+	bool save(string hierarchyFile) const;
+	bool load(string hierarchyFile);
+	bool ready() const;
+	bool findRoute(int from, int to, vector<int>& nodes, vector<int>& edges, double& distance,
+		RouteStats* stats) const;
+private:
+	const StreetMap* StreetMapPtr;
+
+	//an arc of the hierarchy: either one of the graph's own edges, or a shortcut standing for
+	//the arcs first and second, which meet at a node contracted before both of its ends
+	struct Arc
+	{
+		double length;
+		int32_t from;
+		int32_t to;
+		int32_t edge;   //the graph edge this arc is, or -1 for a shortcut
+		int32_t first;
+		int32_t second;
+		int32_t unused; //keeps the layout the same everywhere, since arcs are saved as is
+	};
+	vector<Arc> arcs;
+	vector<int32_t> rank;   //the order the nodes were contracted in
+	int graphNodes;         //the size of the graph the hierarchy was built for,
+	int graphEdges;         //-1 if there isn't one
+	uint64_t graphVersion;  //StreetGraph::version() of that graph, to tell when the map is reloaded
+	uint64_t graphFingerprint; //StreetGraph::fingerprint() of that graph, saved with the hierarchy
+
+	//the search graphs: the arcs leading up the hierarchy from each node, and the arcs leading
+	//up to each node (stored reversed, for the search from the destination)
+	struct SearchArc
+	{
+		int to;
+		double length;
+		int arc;
+	};
+	vector<int> upFirst;
+	vector<SearchArc> up;
+	vector<int> downFirst;
+	vector<SearchArc> down;
+
+	//state while contracting
+	struct Contraction
+	{
+		vector<vector<int>> outArcs;
+		vector<vector<int>> inArcs;
+		vector<char> contracted;
+		vector<double> witnessDistance;
+		vector<int> touched;
+		vector<QueueEntry> witnessQueue; //a min-heap, kept between searches to save reallocating it
+	};
+	int contract(Contraction& c, int v, bool addShortcuts);
+	void findWitnesses(Contraction& c, int from, int avoid, double limit, int settleLimit);
+	void addArc(Contraction& c, int from, int to, double length, int edge, int first, int second);
+	void removeArcsTo(vector<int>& list, int node, bool incoming) const;
+	void buildSearchGraphs();
+	void unpack(int arc, vector<int>& nodes, vector<int>& edges) const;
+};
+
+namespace
+{
+	const double INFINITE_DISTANCE = numeric_limits<double>::infinity();
+
+	//how many nodes a witness search may settle before giving up; giving up early just costs
+	//a shortcut that wasn't needed, never a wrong answer. Estimating a node's priority can
+	//afford to be rougher than actually contracting it.
+	const int WITNESS_SETTLE_LIMIT = 500;
+	const int ESTIMATE_SETTLE_LIMIT = 50;
+
+	struct HierarchyHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;
+		int32_t graphNodes;
+		int32_t graphEdges;
+		int32_t arcCount;
+		int32_t unused;
+		uint64_t graphFingerprint;
+	};
+	const char HIERARCHY_MAGIC[8] = { 'G', 'O', 'O', 'B', 'E', 'R', 'C', 'H' };
+	const uint32_t HIERARCHY_VERSION = 2;
+	const uint32_t HIERARCHY_BYTE_ORDER = 0x01020304;
+
+	//one direction of a query: how far each node is from where that side started and the arc
+	//it was reached by. Each thread keeps its sides from one query to the next; rather than
+	//clearing the arrays, every query has a new number and only entries it wrote count.
+	struct QuerySide
+	{
+		QuerySide() : query(0) {}
+		void begin(int nodeCount, int from)
+		{
+			if ((int)visitedIn.size() != nodeCount || ++query == 0)
+			{
+				distance.assign(nodeCount, INFINITE_DISTANCE);
+				arcUsed.assign(nodeCount, -1);
+				visitedIn.assign(nodeCount, 0);
+				open.reserve(256);
+				query = 1;
+			}
+			open.clear();
+			reach(from, 0, -1);
+		}
+		double distanceOf(int node) const { return visitedIn[node] == query ? distance[node] : INFINITE_DISTANCE; }
+		void reach(int node, double d, int arc)
+		{
+			distance[node] = d;
+			arcUsed[node] = arc;
+			visitedIn[node] = query;
+			open.push_back(QueueEntry(d, node));
+			push_heap(open.begin(), open.end(), greater<QueueEntry>());
+		}
+		QueueEntry pop()
+		{
+			pop_heap(open.begin(), open.end(), greater<QueueEntry>());
+			QueueEntry entry = open.back();
+			open.pop_back();
+			return entry;
+		}
+		vector<double> distance;
+		vector<int> arcUsed;
+		vector<unsigned int> visitedIn;
+		unsigned int query;
+		vector<QueueEntry> open; //a min-heap
+	};
+}
+
+ContractionHierarchyImpl::ContractionHierarchyImpl(const StreetMap* sm)
+{
+	StreetMapPtr = sm;
+	graphNodes = -1;
+	graphEdges = -1;
+	graphVersion = 0;
+	graphFingerprint = 0;
+}
+
+ContractionHierarchyImpl::~ContractionHierarchyImpl()
+{
+}
+
+bool ContractionHierarchyImpl::ready() const
+{
+	const StreetGraph& graph = getStreetGraph(*StreetMapPtr);
+	return graphNodes >= 0 && graphVersion == graph.version();
+}
+
+//Contract the nodes one at a time, least important first. Contracting v removes it from the
+//remaining graph, adding a shortcut x -> y for each pair of arcs x -> v -> y unless there is
+//a path from x to y at least as short that doesn't use v (a witness). A node's importance is
+//the number of shortcuts it would add minus the arcs it would remove, plus how many of its
+//neighbours are already contracted (so contraction spreads evenly over the map).
+void ContractionHierarchyImpl::build()
+{
+	const StreetGraph& graph = getStreetGraph(*StreetMapPtr);
+	int n = graph.nodeCount();
+	arcs.clear();
+
+	Contraction c;
+	c.outArcs.resize(n);
+	c.inArcs.resize(n);
+	c.contracted.assign(n, false);
+	c.witnessDistance.assign(n, INFINITE_DISTANCE);
+	for (int u = 0; u < n; u++)
+	{
+		for (SegmentRef seg : graph.segmentsFrom(u))
+		{
+			//of several segments between the same two nodes only the shortest matters
+			bool dominated = seg.endNode() == u;
+			for (int a : c.outArcs[u])
+			{
+				if (arcs[a].to == seg.endNode() && arcs[a].length <= seg.length())
+					dominated = true;
+			}
+			if (!dominated)
+				addArc(c, u, seg.endNode(), seg.length(), seg.edge(), -1, -1);
+		}
+	}
+
+	vector<int> contractedNeighbours(n, 0);
+	MinQueue order;
+	for (int v = 0; v < n; v++)
+		order.push(QueueEntry(contract(c, v, false), v));
+
+	rank.assign(n, -1);
+	int nextRank = 0;
+	while (!order.empty())
+	{
+		int v = order.top().second;
+		order.pop();
+		if (c.contracted[v])
+			continue;
+
+		//priorities go stale as the graph around a node changes, so check this one is still
+		//the smallest before contracting it
+		double priority = contract(c, v, false) + contractedNeighbours[v];
+		if (!order.empty() && priority > order.top().first)
+		{
+			order.push(QueueEntry(priority, v));
+			continue;
+		}
+
+		contract(c, v, true);
+		c.contracted[v] = true;
+		rank[v] = nextRank++;
+		for (int a : c.outArcs[v])
+		{
+			contractedNeighbours[arcs[a].to]++;
+			removeArcsTo(c.inArcs[arcs[a].to], v, true);
+		}
+		for (int a : c.inArcs[v])
+		{
+			contractedNeighbours[arcs[a].from]++;
+			removeArcsTo(c.outArcs[arcs[a].from], v, false);
+		}
+	}
+
+	graphNodes = n;
+	graphEdges = graph.edgeCount();
+	graphVersion = graph.version();
+	graphFingerprint = graph.fingerprint();
+	buildSearchGraphs();
+}
+
+//the edge difference of contracting v: shortcuts needed minus live arcs removed. If
+//addShortcuts is true, the shortcuts are added too.
+int ContractionHierarchyImpl::contract(Contraction& c, int v, bool addShortcuts)
+{
+	int removed = 0, shortcuts = 0;
+	for (int a : c.outArcs[v])
+	{
+		if (!c.contracted[arcs[a].to])
+			removed++;
+	}
+	for (int in : c.inArcs[v])
+	{
+		int x = arcs[in].from;
+		if (c.contracted[x])
+			continue;
+		removed++;
+
+		double limit = 0;
+		for (int out : c.outArcs[v])
+		{
+			if (!c.contracted[arcs[out].to] && arcs[out].to != x && arcs[in].length + arcs[out].length > limit)
+				limit = arcs[in].length + arcs[out].length;
+		}
+		if (limit == 0)
+			continue;
+		findWitnesses(c, x, v, limit, addShortcuts ? WITNESS_SETTLE_LIMIT : ESTIMATE_SETTLE_LIMIT);
+
+		//copy the list, since adding shortcuts may add to it
+		vector<int> outs = c.outArcs[v];
+		for (int out : outs)
+		{
+			int y = arcs[out].to;
+			double via = arcs[in].length + arcs[out].length;
+			if (c.contracted[y] || y == x || c.witnessDistance[y] <= via)
+				continue;
+			shortcuts++;
+			if (addShortcuts)
+			{
+				addArc(c, x, y, via, -1, in, out);
+				//the new shortcut is a witness for any later, longer pair through v
+				if (c.witnessDistance[y] == INFINITE_DISTANCE)
+					c.touched.push_back(y);
+				c.witnessDistance[y] = via;
+			}
+		}
+	}
+	return shortcuts - removed;
+}
+
+//Dijkstra from `from` over the uncontracted graph without `avoid`, up to distance limit,
+//leaving the distances in c.witnessDistance
+void ContractionHierarchyImpl::findWitnesses(Contraction& c, int from, int avoid, double limit, int settleLimit)
+{
+	for (int node : c.touched)
+		c.witnessDistance[node] = INFINITE_DISTANCE;
+	c.touched.clear();
+
+	vector<QueueEntry>& open = c.witnessQueue;
+	open.clear();
+	c.witnessDistance[from] = 0;
+	c.touched.push_back(from);
+	open.push_back(QueueEntry(0, from));
+	int settled = 0;
+	while (!open.empty() && settled < settleLimit)
+	{
+		pop_heap(open.begin(), open.end(), greater<QueueEntry>());
+		QueueEntry current = open.back();
+		open.pop_back();
+		if (current.first > c.witnessDistance[current.second])
+			continue;
+		if (current.first > limit)
+			break;
+		settled++;
+		for (int a : c.outArcs[current.second])
+		{
+			int next = arcs[a].to;
+			if (next == avoid || c.contracted[next])
+				continue;
+			double d = current.first + arcs[a].length;
+			if (d < c.witnessDistance[next])
+			{
+				if (c.witnessDistance[next] == INFINITE_DISTANCE)
+					c.touched.push_back(next);
+				c.witnessDistance[next] = d;
+				open.push_back(QueueEntry(d, next));
+				push_heap(open.begin(), open.end(), greater<QueueEntry>());
+			}
+		}
+	}
+}
+
+void ContractionHierarchyImpl::addArc(Contraction& c, int from, int to, double length, int edge, int first, int second)
+{
+	Arc arc;
+	arc.length = length;
+	arc.from = from;
+	arc.to = to;
+	arc.edge = edge;
+	arc.first = first;
+	arc.second = second;
+	arc.unused = 0;
+	c.outArcs[from].push_back((int)arcs.size());
+	c.inArcs[to].push_back((int)arcs.size());
+	arcs.push_back(arc);
+}
+
+//drop the arcs to (or, for an in-arc list, from) a contracted node from a neighbour's list,
+//so later witness searches and estimates don't keep stepping over them
+void ContractionHierarchyImpl::removeArcsTo(vector<int>& list, int node, bool incoming) const
+{
+	int kept = 0;
+	for (int i = 0; i < (int)list.size(); i++)
+	{
+		if ((incoming ? arcs[list[i]].from : arcs[list[i]].to) != node)
+			list[kept++] = list[i];
+	}
+	list.resize(kept);
+}
+
+//an arc goes up the hierarchy if it leads to a node contracted later
+void ContractionHierarchyImpl::buildSearchGraphs()
+{
+	int n = graphNodes;
+	upFirst.assign(n + 1, 0);
+	downFirst.assign(n + 1, 0);
+	for (int a = 0; a < (int)arcs.size(); a++)
+	{
+		if (rank[arcs[a].from] < rank[arcs[a].to])
+			upFirst[arcs[a].from + 1]++;
+		else
+			downFirst[arcs[a].to + 1]++;
+	}
+	for (int i = 0; i < n; i++)
+	{
+		upFirst[i + 1] += upFirst[i];
+		downFirst[i + 1] += downFirst[i];
+	}
+	up.resize(upFirst[n]);
+	down.resize(downFirst[n]);
+	vector<int> nextUp(upFirst.begin(), upFirst.end() - 1);
+	vector<int> nextDown(downFirst.begin(), downFirst.end() - 1);
+	for (int a = 0; a < (int)arcs.size(); a++)
+	{
+		const Arc& arc = arcs[a];
+		if (rank[arc.from] < rank[arc.to])
+			up[nextUp[arc.from]++] = SearchArc{ arc.to, arc.length, a };
+		else
+			down[nextDown[arc.to]++] = SearchArc{ arc.from, arc.length, a };
+	}
+}
+
+//Bidirectional Dijkstra in which both searches only go up the hierarchy. Every shortest path
+//climbs to its highest node and then descends, so the two searches meet at that node; a side
+//can stop once nothing left in its queue is shorter than the best meeting found.
+bool ContractionHierarchyImpl::findRoute(int from, int to, vector<int>& nodes, vector<int>& edges,
+	double& distance, RouteStats* stats) const
+{
+	nodes.clear();
+	edges.clear();
+	distance = 0;
+	//the per-node arrays only fit the graph the hierarchy was made for
+	if (!ready() || from < 0 || from >= graphNodes || to < 0 || to >= graphNodes)
+		return false;
+	if (from == to)
+	{
+		nodes.push_back(from);
+		return true;
+	}
+
+	static thread_local QuerySide forward, backward;
+	forward.begin(graphNodes, from);
+	backward.begin(graphNodes, to);
+
+	double best = INFINITE_DISTANCE;
+	int meetingPoint = -1;
+	long long expanded = 0, relaxed = 0;
+	while (true)
+	{
+		bool forwardLive = !forward.open.empty() && forward.open.front().first < best;
+		bool backwardLive = !backward.open.empty() && backward.open.front().first < best;
+		if (!forwardLive && !backwardLive)
+			break;
+		bool goForward = forwardLive && (!backwardLive || forward.open.front().first <= backward.open.front().first);
+
+		QuerySide& mine = goForward ? forward : backward;
+		const QuerySide& other = goForward ? backward : forward;
+		const vector<int>& first = goForward ? upFirst : downFirst;
+		const vector<SearchArc>& searchArcs = goForward ? up : down;
+
+		QueueEntry current = mine.pop();
+		int u = current.second;
+		if (current.first > mine.distanceOf(u))
+			continue;
+		if (current.first + other.distanceOf(u) < best)
+		{
+			best = current.first + other.distanceOf(u);
+			meetingPoint = u;
+		}
+		if (statsEnabled)
+		{
+			expanded++;
+			relaxed += first[u + 1] - first[u];
+		}
+		for (int i = first[u]; i < first[u + 1]; i++)
+		{
+			double d = current.first + searchArcs[i].length;
+			if (d < mine.distanceOf(searchArcs[i].to))
+				mine.reach(searchArcs[i].to, d, searchArcs[i].arc);
+		}
+	}
+	if (statsEnabled && stats != nullptr)
+	{
+		stats->nodesExpanded += expanded;
+		stats->edgesRelaxed += relaxed;
+	}
+	if (meetingPoint == -1)
+		return false;
+
+	//the hierarchy arcs from the start up to the meeting point, then down to the destination
+	vector<int> path;
+	for (int node = meetingPoint; node != from; node = arcs[forward.arcUsed[node]].from)
+		path.push_back(forward.arcUsed[node]);
+	reverse(path.begin(), path.end());
+	for (int node = meetingPoint; node != to; node = arcs[backward.arcUsed[node]].to)
+		path.push_back(backward.arcUsed[node]);
+
+	nodes.push_back(from);
+	for (int a : path)
+		unpack(a, nodes, edges);
+	for (int e : edges)
+		distance += getStreetGraph(*StreetMapPtr).edgeLength(e);
+	return true;
+}
+
+//replace a hierarchy arc by the graph edges it stands for, appending them (and the node each
+//one ends at) in travel order
+void ContractionHierarchyImpl::unpack(int arc, vector<int>& nodes, vector<int>& edges) const
+{
+	vector<int> pending(1, arc);
+	while (!pending.empty())
+	{
+		const Arc& a = arcs[pending.back()];
+		pending.pop_back();
+		if (a.edge != -1)
+		{
+			edges.push_back(a.edge);
+			nodes.push_back(a.to);
+		}
+		else
+		{
+			pending.push_back(a.second);
+			pending.push_back(a.first);
+		}
+	}
+}
+
+bool ContractionHierarchyImpl::save(string hierarchyFile) const
+{
+	if (graphNodes < 0)
+		return false;
+	ofstream out(hierarchyFile, ios::binary);
+	if (!out)
+		return false;
+	HierarchyHeader h;
+	memcpy(h.magic, HIERARCHY_MAGIC, sizeof(h.magic));
+	h.version = HIERARCHY_VERSION;
+	h.byteOrder = HIERARCHY_BYTE_ORDER;
+	h.graphNodes = graphNodes;
+	h.graphEdges = graphEdges;
+	h.arcCount = (int32_t)arcs.size();
+	h.unused = 0;
+	h.graphFingerprint = graphFingerprint;
+	out.write((const char*)&h, sizeof(h));
+	out.write((const char*)rank.data(), sizeof(int32_t) * rank.size());
+	out.write((const char*)arcs.data(), sizeof(Arc) * arcs.size());
+	return (bool)out;
+}
+
+bool ContractionHierarchyImpl::load(string hierarchyFile)
+{
+	ifstream in(hierarchyFile, ios::binary);
+	HierarchyHeader h;
+	if (!in || !in.read((char*)&h, sizeof(h)))
+		return false;
+	const StreetGraph& graph = getStreetGraph(*StreetMapPtr);
+	if (memcmp(h.magic, HIERARCHY_MAGIC, sizeof(h.magic)) != 0 || h.version != HIERARCHY_VERSION ||
+		h.byteOrder != HIERARCHY_BYTE_ORDER || h.graphNodes != graph.nodeCount() ||
+		h.graphEdges != graph.edgeCount() || h.arcCount < 0 || h.graphFingerprint != graph.fingerprint())
+		return false;
+
+	vector<int32_t> newRank(h.graphNodes);
+	vector<Arc> newArcs(h.arcCount);
+	if (!in.read((char*)newRank.data(), sizeof(int32_t) * newRank.size()) ||
+		!in.read((char*)newArcs.data(), sizeof(Arc) * newArcs.size()))
+		return false;
+	//the ranks have to give every node its own place in the order
+	vector<bool> rankUsed(h.graphNodes, false);
+	for (int v = 0; v < h.graphNodes; v++)
+	{
+		if (newRank[v] < 0 || newRank[v] >= h.graphNodes || rankUsed[newRank[v]])
+			return false;
+		rankUsed[newRank[v]] = true;
+	}
+	//an arc must be the graph edge it says it is, or a shortcut joining two arcs made before it
+	//(as build() makes them), so unpacking one always comes down to graph edges. Either way its
+	//length is what build() would have given it, which also keeps it finite and not negative.
+	for (int i = 0; i < h.arcCount; i++)
+	{
+		const Arc& a = newArcs[i];
+		if (a.from < 0 || a.from >= h.graphNodes || a.to < 0 || a.to >= h.graphNodes || a.edge >= h.graphEdges ||
+			!(a.length >= 0) || a.length == numeric_limits<double>::infinity())
+			return false;
+		if (a.edge >= 0)
+		{
+			if (a.to != graph.edgeTarget(a.edge) || a.edge < graph.firstEdge(a.from) ||
+				a.edge >= graph.firstEdge(a.from + 1) || a.length != graph.edgeLength(a.edge))
+				return false;
+		}
+		else if (a.first < 0 || a.first >= i || a.second < 0 || a.second >= i ||
+			newArcs[a.first].from != a.from || newArcs[a.first].to != newArcs[a.second].from ||
+			newArcs[a.second].to != a.to || a.length != newArcs[a.first].length + newArcs[a.second].length)
+			return false;
+	}
+	rank.swap(newRank);
+	arcs.swap(newArcs);
+	graphNodes = h.graphNodes;
+	graphEdges = h.graphEdges;
+	graphVersion = graph.version();
+	graphFingerprint = h.graphFingerprint;
+	buildSearchGraphs();
+	return true;
+}
+
+//******************** ContractionHierarchy functions *************************
+
+// These functions simply delegate to ContractionHierarchyImpl's functions.
+
+ContractionHierarchy::ContractionHierarchy(const StreetMap* sm)
+{
+	m_impl = new ContractionHierarchyImpl(sm);
+}
+
+ContractionHierarchy::~ContractionHierarchy()
+{
+	delete m_impl;
+}
+
+void ContractionHierarchy::build()
+{
+	m_impl->build();
+}
+
+bool ContractionHierarchy::save(string hierarchyFile) const
+{
+	return m_impl->save(hierarchyFile);
+}
+
+bool ContractionHierarchy::load(string hierarchyFile)
+{
+	return m_impl->load(hierarchyFile);
+}
+
+bool ContractionHierarchy::ready() const
+{
+	return m_impl->ready();
+}
+
+bool ContractionHierarchy::findRoute(int from, int to, vector<int>& nodes, vector<int>& edges,
+	double& distance, RouteStats* stats) const
+{
+	return m_impl->findRoute(from, to, nodes, edges, distance, stats);
+}
@@ -1,8 +1,13 @@
 #include "provided.h"
+#include "support.h"
+#include "ThreadPool.h"
 #include <vector>
 #include <cmath>
 #include <utility>
 #include <random>
+#include <algorithm>
+#include <chrono>
+#include <limits>
 using namespace std;
 
 class DeliveryOptimizerImpl
@@ -15,49 +20,62 @@ public:
 		vector<DeliveryRequest>& deliveries,
 		double& oldCrowDistance,
 		double& newCrowDistance) const;
+	void optimizeDeliveryOrder(
+		vector<DeliveryRequest>& deliveries,
+		const DistanceMatrix& distances,
+		double& oldDistance,
+		double& newDistance,
+		AnnealingStats* stats) const;
+	bool optimizeFleetDeliveryOrder(
+		const vector<DeliveryRequest>& deliveries,
+		const DistanceMatrix& distances,
+		const FleetOptions& fleet,
+		vector<VehiclePlan>& vehicles) const;
+	void setAnnealingOptions(const AnnealingOptions& options) { annealing = options; }
 private:
-	void calculateCrowDistance(double& crowDistance, vector<DeliveryRequest> deliveries, const GeoCoord depot) const
+	//the ways the annealing can change a tour. Each is applied to the order in place, and its
+	//effect on the tour's length only depends on the few stops next to where it changes.
+	enum MoveKind { SWAP_TWO, REVERSE_RUN, MOVE_RUN };
+	struct TourMove
 	{
-		crowDistance = distanceEarthMiles(depot, deliveries[0].location);
-		for (int i = 0; i < deliveries.size() - 1; i++)
-		{
-			crowDistance += distanceEarthMiles(deliveries[i].location, deliveries[i + 1].location);
-		}
-		crowDistance += distanceEarthMiles(deliveries[deliveries.size() - 1].location, depot);
-	}
+		MoveKind kind;
+		int i, j;   //SWAP_TWO: swap order[i] and order[j]; REVERSE_RUN: reverse order[i..j]
+		int length; //MOVE_RUN: move order[i .. i + length - 1] to just after order[j] (j = -1: the depot)
+	};
 
-	vector<DeliveryRequest> reorderDeliveries(const vector<DeliveryRequest> deliveries) const
+	//the length of the tour depot -> order[0] -> ... -> order[n - 1] -> depot, where order holds
+	//rows of distances and the depot is row 0
+	void calculateDistance(double& distance, const vector<int>& order, const DistanceMatrix& distances) const
 	{
-		vector<DeliveryRequest> randomlyGeneratedDeliveries;
-		for (int i = 0; i < deliveries.size(); i++)
+		distance = distances.at(0, order[0]);
+		for (int i = 0; i < order.size() - 1; i++)
 		{
-			randomlyGeneratedDeliveries.push_back(deliveries[i]);
+			distance += distances.at(order[i], order[i + 1]);
 		}
-
-		int randomIndexOne = randInt(0, deliveries.size() - 1);
-		int randomIndexTwo = randInt(0, deliveries.size() - 1);
-
-		string tempItem = randomlyGeneratedDeliveries[randomIndexOne].item;
-		GeoCoord tempLocation = randomlyGeneratedDeliveries[randomIndexOne].location;
-		randomlyGeneratedDeliveries[randomIndexOne].item = randomlyGeneratedDeliveries[randomIndexTwo].item;
-		randomlyGeneratedDeliveries[randomIndexOne].location = randomlyGeneratedDeliveries[randomIndexTwo].location;
-		randomlyGeneratedDeliveries[randomIndexTwo].item = tempItem;
-		randomlyGeneratedDeliveries[randomIndexTwo].location = tempLocation;
-
-		return randomlyGeneratedDeliveries;
+		distance += distances.at(order[order.size() - 1], 0);
 	}
 
+	//one chain of the annealing: order (whose length is distance) is replaced by the shortest
+	//tour the chain finds before it cools down or runs out of budget. The steps it takes and
+	//keeps are added to counts (when stats are being collected).
+	void anneal(vector<int>& order, double distance, const DistanceMatrix& distances, bool canReverse,
+		mt19937& generator, chrono::steady_clock::time_point started, chrono::steady_clock::time_point deadline,
+		AnnealingStats& counts) const;
+	TourMove pickMove(mt19937& generator, int n, bool canReverse) const;
+	double moveDelta(const TourMove& move, const vector<int>& order, const DistanceMatrix& distances) const;
+	void applyMove(const TourMove& move, vector<int>& order) const;
+
+	//each chain has its own generator, so chains (and optimizers) can run on different threads
 	inline
-		int randInt(int min, int max) const
+		int randInt(mt19937& generator, int min, int max) const
 	{
 		if (max < min)
 			std::swap(max, min);
-		static std::random_device rd;
-		static std::default_random_engine generator(rd());
 		std::uniform_int_distribution<> distro(min, max);
 		return distro(generator);
 	}
 	const StreetMap* StreetMapPtr;
+	AnnealingOptions annealing;
 };
 
 DeliveryOptimizerImpl::DeliveryOptimizerImpl(const StreetMap* sm)
@@ -75,64 +93,369 @@ void DeliveryOptimizerImpl::optimizeDeliveryOrder(
 	double& oldCrowDistance,
 	double& newCrowDistance) const
 {
-	////Simulated Annealing: 
+	//straight line ("crow") distances between the depot (row 0) and every delivery
+	DistanceMatrix crow;
+	crow.resize(deliveries.size() + 1);
+	for (int i = 0; i <= deliveries.size(); i++)
+	{
+		const GeoCoord& from = (i == 0 ? depot : deliveries[i - 1].location);
+		for (int j = 0; j <= deliveries.size(); j++)
+			crow.set(i, j, distanceEarthMiles(from, j == 0 ? depot : deliveries[j - 1].location));
+	}
+	optimizeDeliveryOrder(deliveries, crow, oldCrowDistance, newCrowDistance, nullptr);
+}
+
+void DeliveryOptimizerImpl::optimizeDeliveryOrder(
+	vector<DeliveryRequest>& deliveries,
+	const DistanceMatrix& distances,
+	double& oldDistance,
+	double& newDistance,
+	AnnealingStats* stats) const
+{
+	ScopedTimer timer(stats != nullptr ? &stats->milliseconds : nullptr);
+	oldDistance = newDistance = 0;
+	if (deliveries.empty())
+		return;
 
-	calculateCrowDistance(oldCrowDistance, deliveries, depot);
-	cerr << "Old Deliveries: ///////////////////////////\n";
+	////Simulated Annealing: 
+	//the tour is kept as the order to visit rows of the distance matrix in; deliveries[i] is row i + 1
+	vector<int> order;
 	for (int i = 0; i < deliveries.size(); i++)
+		order.push_back(i + 1);
+
+	calculateDistance(oldDistance, order, distances);
+
+	//reversing a run of the tour only leaves the distances inside it alone if they are the same
+	//both ways, which road and crow distances are; check rather than assume it
+	bool canReverse = true;
+	for (int i = 0; i < distances.size() && canReverse; i++)
+		for (int j = 0; j < i && canReverse; j++)
+			canReverse = (distances.at(i, j) == distances.at(j, i));
+
+	//run the chains, each from the same order with its own generator, sharing them out over
+	//the pool. Which thread runs a chain doesn't change its result, so neither does the machine.
+	unsigned int seed = annealing.seed;
+	if (seed == 0)
+		seed = random_device()();
+	int chains = max(1, annealing.chains);
+	chrono::steady_clock::time_point started = chrono::steady_clock::now();
+	chrono::steady_clock::time_point deadline = annealing.deadline;
+	if (annealing.maxMilliseconds > 0)
+		deadline = min(deadline, started + chrono::duration_cast<chrono::steady_clock::duration>(
+			chrono::duration<double, milli>(annealing.maxMilliseconds)));
+	vector<vector<int>> tours(chains, order);
+	vector<AnnealingStats> chainCounts(chains);
+	ThreadPool::shared().parallelFor(chains, [&](int c) {
+		seed_seq chainSeed{ seed, (unsigned int)c };
+		mt19937 generator(chainSeed);
+		anneal(tours[c], oldDistance, distances, canReverse, generator, started, deadline, chainCounts[c]);
+	});
+	if (statsEnabled && stats != nullptr)
 	{
-		cerr <<i<< " j "<< deliveries[i].item << " k ";
+		for (int c = 0; c < chains; c++)
+			stats->add(chainCounts[c]);
 	}
-	cerr << endl;
 
+	//keep the shortest tour, preferring the lowest numbered chain on a tie
+	double bestDistance = 0;
+	for (int c = 0; c < chains; c++)
+	{
+		double distance;
+		calculateDistance(distance, tours[c], distances);
+		if (c == 0 || distance < bestDistance)
+		{
+			bestDistance = distance;
+			order = tours[c];
+		}
+	}
+
+	//put the deliveries in the order found
+	vector<DeliveryRequest> optimizedDeliveries;
+	for (int i = 0; i < order.size(); i++)
+		optimizedDeliveries.push_back(deliveries[order[i] - 1]);
+	deliveries = optimizedDeliveries;
+
+	calculateDistance(newDistance, order, distances);
+}
+
+void DeliveryOptimizerImpl::anneal(vector<int>& order, double distance, const DistanceMatrix& distances,
+	bool canReverse, mt19937& generator, chrono::steady_clock::time_point started,
+	chrono::steady_clock::time_point deadline, AnnealingStats& counts) const
+{
+	if (statsEnabled)
+		counts.chains++;
 	double temperature = 10000.0;
 	double deltaDistance = 0;
 	double coolingRate = 0.9999;
 	double absoluteTemperature = 0.00001;
 
-	double distance = 0;
-	calculateCrowDistance(distance, deliveries, depot);
+	//how many steps cooling from temperature to absoluteTemperature takes, unless told otherwise
+	long long budget = (long long)ceil(log(absoluteTemperature / temperature) / log(coolingRate));
+	if (annealing.maxIterations > 0 && (annealing.adaptiveCooling || annealing.maxIterations < budget))
+		budget = annealing.maxIterations;
+	bool timed = (deadline != chrono::steady_clock::time_point::max());
+	double secondsAllowed = chrono::duration<double>(deadline - started).count();
 
-	vector<DeliveryRequest> newDeliveries; 
-	for (int i = 0; i < deliveries.size(); i++)
+	//adaptive cooling starts from the size of the uphill moves this tour actually has, and cools
+	//to a ten-thousandth of that evenly over whichever of the steps or the time runs out first
+	double startTemperature = temperature;
+	double temperatureRange = absoluteTemperature / temperature;
+	if (annealing.adaptiveCooling && order.size() > 1)
 	{
-		newDeliveries.push_back(deliveries[i]);
+		double uphill = 0;
+		int uphillMoves = 0;
+		for (int k = 0; k < 100; k++)
+		{
+			double delta = moveDelta(pickMove(generator, order.size(), canReverse), order, distances);
+			if (delta > 0)
+			{
+				uphill += delta;
+				uphillMoves++;
+			}
+		}
+		startTemperature = temperature = (uphillMoves > 0 ? uphill / uphillMoves : 1.0);
+		temperatureRange = 1e-4;
+		coolingRate = pow(temperatureRange, 1.0 / budget);
 	}
 
-	while (temperature > absoluteTemperature)
+	vector<int> best = order;
+	double bestDistance = distance;
+	long long sinceBest = 0;
+	long long step = 0, accepted = 0;
+	for (; order.size() > 1 && step < budget; step++)
 	{
-		//to randomly swap any two items in the vector
-		newDeliveries = reorderDeliveries(deliveries);
+		//looking at the clock costs more than a step, so only do it every so often
+		if (timed && step % 256 == 0)
+		{
+			double secondsUsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+			if (secondsUsed >= secondsAllowed)
+				break;
+			if (annealing.adaptiveCooling)
+				temperature = startTemperature * pow(temperatureRange, max((double)step / budget, secondsUsed / secondsAllowed));
+		}
 
-		double tempNewDistance = 0;
-		calculateCrowDistance(tempNewDistance, newDeliveries, depot);
-		deltaDistance =  tempNewDistance - distance;
+		//to randomly pick a change to the order, and see how much it would change the distance by
+		TourMove move = pickMove(generator, order.size(), canReverse);
+		deltaDistance = moveDelta(move, order, distances);
 		
 		//to calculate a random number between 0 and 1
-		int toBeRandom = randInt(0, 1000);
+		int toBeRandom = randInt(generator, 0, 1000);
 		double nowRandom = (double)toBeRandom / 1000; 
 		//doing this, turns any toBeRandom into a decimal number between 0 and 1.
 
 		//accept the new solution if it has a smaller distance or satisfies the Boltzman condition
 		if ((deltaDistance < 0) || (distance > 0 && (double)exp(-deltaDistance / temperature) > nowRandom))
 		{
-			for (int i = 0; i < newDeliveries.size(); i++)
-				deliveries[i] = newDeliveries[i];
+			applyMove(move, order);
 
 			distance = deltaDistance + distance;
+			accepted++;
+		}
+
+		//remember the shortest tour so far, and give up once it stops getting shorter
+		if (distance < bestDistance)
+		{
+			best = order;
+			bestDistance = distance;
+			sinceBest = 0;
 		}
+		else if (annealing.stallIterations > 0 && ++sinceBest >= annealing.stallIterations)
+			break;
 
 		//cool down the temperature
 		temperature *= coolingRate;
 	}
+	order = best;
+	if (statsEnabled)
+	{
+		counts.iterations += step;
+		counts.accepted += accepted;
+	}
+}
 
-	calculateCrowDistance(newCrowDistance, deliveries, depot);
+bool DeliveryOptimizerImpl::optimizeFleetDeliveryOrder(
+	const vector<DeliveryRequest>& deliveries,
+	const DistanceMatrix& distances,
+	const FleetOptions& fleet,
+	vector<VehiclePlan>& vehicles) const
+{
+	int n = deliveries.size();
+	if (!fleet.weights.empty() && fleet.weights.size() != n)
+		return false;
+	double capacity = (fleet.capacity > 0 ? fleet.capacity : numeric_limits<double>::infinity());
+	vector<double> load(n + 1, 0); //what the trip starting with each row carries; row 0 is the depot
+	for (int i = 0; i < n; i++)
+	{
+		load[i + 1] = (fleet.weights.empty() ? 1.0 : fleet.weights[i]);
+		if (load[i + 1] > capacity)
+			return false;
+	}
+	int vehicleCount = max(1, fleet.vehicles);
 
-	cerr << "Old Crow Distance: " << oldCrowDistance << " New Crow Distance: " << newCrowDistance << endl;
-	cerr << "New deliveries: //////////////////////////////////////////////\n";
-	for (int i = 0; i < deliveries.size(); i++)
+	//Clarke and Wright's savings: start with a trip for every delivery, then join one trip's end
+	//to another's start, in order of how much driving it saves, as long as the load still fits.
+	//Joining stops once there are only as many trips as vehicles, so every vehicle gets used.
+	struct Saving
 	{
-		cerr << deliveries[i].item << " ";
+		double amount;
+		int from, to;
+		bool operator<(const Saving& other) const
+		{
+			if (amount != other.amount)
+				return amount > other.amount;
+			return from != other.from ? from < other.from : to < other.to;
+		}
+	};
+	vector<Saving> savings;
+	for (int i = 1; i <= n; i++)
+	{
+		for (int j = 1; j <= n; j++)
+		{
+			double amount = distances.at(i, 0) + distances.at(0, j) - distances.at(i, j);
+			if (i != j && amount > 0)
+				savings.push_back(Saving{ amount, i, j });
+		}
+	}
+	sort(savings.begin(), savings.end());
+
+	vector<vector<int>> trips(n + 1);  //trips[r] is the trip whose first row was r, if it's still separate
+	vector<int> tripOf(n + 1);
+	for (int r = 1; r <= n; r++)
+	{
+		trips[r].push_back(r);
+		tripOf[r] = r;
+	}
+	int tripCount = n;
+	for (int k = 0; k < savings.size() && tripCount > vehicleCount; k++)
+	{
+		int a = tripOf[savings[k].from], b = tripOf[savings[k].to];
+		if (a == b || trips[a].back() != savings[k].from || trips[b].front() != savings[k].to)
+			continue;
+		if (load[a] + load[b] > capacity)
+			continue;
+		for (int i = 0; i < trips[b].size(); i++)
+		{
+			trips[a].push_back(trips[b][i]);
+			tripOf[trips[b][i]] = a;
+		}
+		load[a] += load[b];
+		trips[b].clear();
+		tripCount--;
+	}
+
+	//order the deliveries of each trip, using the distances between just its own stops
+	vector<int> firstRows;
+	for (int r = 1; r <= n; r++)
+		if (!trips[r].empty())
+			firstRows.push_back(r);
+	vector<vector<DeliveryRequest>> ordered(firstRows.size());
+	vector<double> tripDistances(firstRows.size());
+	ThreadPool::shared().parallelFor((int)firstRows.size(), [&](int t) {
+		const vector<int>& rows = trips[firstRows[t]];
+		DistanceMatrix own;
+		own.resize(rows.size() + 1);
+		for (int i = 0; i <= rows.size(); i++)
+			for (int j = 0; j <= rows.size(); j++)
+				own.set(i, j, distances.at(i == 0 ? 0 : rows[i - 1], j == 0 ? 0 : rows[j - 1]));
+		for (int i = 0; i < rows.size(); i++)
+			ordered[t].push_back(deliveries[rows[i] - 1]);
+		double oldDistance;
+		optimizeDeliveryOrder(ordered[t], own, oldDistance, tripDistances[t], nullptr);
+	});
+
+	//longest trips first, each to the vehicle with the least driving so far
+	vector<int> byLength(firstRows.size());
+	for (int t = 0; t < byLength.size(); t++)
+		byLength[t] = t;
+	stable_sort(byLength.begin(), byLength.end(), [&](int x, int y) { return tripDistances[x] > tripDistances[y]; });
+	vehicles.assign(vehicleCount, VehiclePlan());
+	for (int k = 0; k < byLength.size(); k++)
+	{
+		int v = 0;
+		for (int w = 1; w < vehicleCount; w++)
+			if (vehicles[w].distance < vehicles[v].distance)
+				v = w;
+		vehicles[v].trips.push_back(ordered[byLength[k]]);
+		vehicles[v].distance += tripDistances[byLength[k]];
+	}
+	return true;
+}
+
+DeliveryOptimizerImpl::TourMove DeliveryOptimizerImpl::pickMove(mt19937& generator, int n, bool canReverse) const
+{
+	TourMove move;
+	int kind = randInt(generator, 0, canReverse ? 2 : 1);
+	move.kind = (kind == 0 ? SWAP_TWO : kind == 1 ? MOVE_RUN : REVERSE_RUN);
+	move.length = 0;
+	if (move.kind == MOVE_RUN)
+	{
+		//a run of up to three stops, put back somewhere other than where it already is
+		move.length = randInt(generator, 1, min(3, n - 1));
+		move.i = randInt(generator, 0, n - move.length);
+		move.j = randInt(generator, -1, n - move.length - 2);
+		if (move.j >= move.i - 1)
+			move.j += move.length + 1;
+		return move;
+	}
+	move.i = randInt(generator, 0, n - 1);
+	move.j = randInt(generator, 0, n - 2);
+	if (move.j >= move.i)
+		move.j++;
+	if (move.i > move.j)
+		std::swap(move.i, move.j);
+	return move;
+}
+
+double DeliveryOptimizerImpl::moveDelta(const TourMove& move, const vector<int>& order, const DistanceMatrix& distances) const
+{
+	int n = order.size();
+	//the row at position p of the tour, where the depot is both before the first and after the last
+	auto stop = [&](int p) { return (p < 0 || p >= n) ? 0 : order[p]; };
+	auto d = [&](int from, int to) { return distances.at(from, to); };
+	int i = move.i, j = move.j;
+
+	switch (move.kind)
+	{
+	case SWAP_TWO:
+	{
+		int a = order[i], b = order[j];
+		if (j == i + 1)
+			return d(stop(i - 1), b) + d(b, a) + d(a, stop(j + 1))
+				- d(stop(i - 1), a) - d(a, b) - d(b, stop(j + 1));
+		return d(stop(i - 1), b) + d(b, stop(i + 1)) + d(stop(j - 1), a) + d(a, stop(j + 1))
+			- d(stop(i - 1), a) - d(a, stop(i + 1)) - d(stop(j - 1), b) - d(b, stop(j + 1));
+	}
+	case REVERSE_RUN:
+		return d(stop(i - 1), order[j]) + d(order[i], stop(j + 1))
+			- d(stop(i - 1), order[i]) - d(order[j], stop(j + 1));
+	case MOVE_RUN:
+	{
+		int first = order[i], last = order[i + move.length - 1];
+		int before = stop(i - 1), after = stop(i + move.length);
+		double removed = d(before, after) - d(before, first) - d(last, after);
+		double inserted = d(stop(j), first) + d(last, stop(j + 1)) - d(stop(j), stop(j + 1));
+		return removed + inserted;
+	}
+	}
+	return 0;
+}
+
+void DeliveryOptimizerImpl::applyMove(const TourMove& move, vector<int>& order) const
+{
+	switch (move.kind)
+	{
+	case SWAP_TWO:
+		std::swap(order[move.i], order[move.j]);
+		break;
+	case REVERSE_RUN:
+		std::reverse(order.begin() + move.i, order.begin() + move.j + 1);
+		break;
+	case MOVE_RUN:
+		if (move.j < move.i)
+			std::rotate(order.begin() + move.j + 1, order.begin() + move.i, order.begin() + move.i + move.length);
+		else
+			std::rotate(order.begin() + move.i, order.begin() + move.i + move.length, order.begin() + move.j + 1);
+		break;
 	}
 }
 
@@ -160,3 +483,20 @@ void DeliveryOptimizer::optimizeDeliveryOrder(
 {
 	return m_impl->optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance);
 }
+
+void optimizeDeliveryOrder(const DeliveryOptimizer& optimizer, vector<DeliveryRequest>& deliveries,
+	const DistanceMatrix& roads, double& oldDistance, double& newDistance, AnnealingStats* stats)
+{
+	implOf<DeliveryOptimizerImpl>(optimizer)->optimizeDeliveryOrder(deliveries, roads, oldDistance, newDistance, stats);
+}
+
+void setAnnealingOptions(DeliveryOptimizer& optimizer, const AnnealingOptions& options)
+{
+	implOf<DeliveryOptimizerImpl>(optimizer)->setAnnealingOptions(options);
+}
+
+bool optimizeFleetDeliveryOrder(const DeliveryOptimizer& optimizer, const vector<DeliveryRequest>& deliveries,
+	const DistanceMatrix& roads, const FleetOptions& fleet, vector<VehiclePlan>& vehicles)
+{
+	return implOf<DeliveryOptimizerImpl>(optimizer)->optimizeFleetDeliveryOrder(deliveries, roads, fleet, vehicles);
+}
@@ -1,7 +1,54 @@
 #include "provided.h"
+#include "support.h"
+#include "ThreadPool.h"
 #include <vector>
+#include <utility>
+#include <map>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <random>
 using namespace std;
 
+//everything a LivePlan keeps between changes
+class LivePlanImpl
+{
+public:
+	LivePlanImpl() : clock(0), positionRow(0), legObjective(ROUTE_SHORTEST), totalDistanceTravelled(0) {}
+	GeoCoord depot;
+	GeoCoord position;
+	double clock; //when the driver is at position, as for the planner's departure time
+	vector<DeliveryRequest> deliveries;
+	//every location the plan has needed distances for, and the road distances between them.
+	//Row 0 is the depot; locations that are no longer stops keep their rows until there are
+	//enough of those to be worth dropping.
+	vector<GeoCoord> points;
+	DistanceMatrix roads;
+	int positionRow;
+	vector<int> deliveryRows; //deliveryRows[i] is the row of deliveries[i]
+	//legs[i] leads to deliveries[i] (legs[0] from position), and the last leg back to the depot;
+	//legRows[i] are the rows it goes between and legDepartures[i] when it sets off. The legs
+	//were routed for legObjective.
+	vector<Route> legs;
+	vector<pair<int, int>> legRows;
+	vector<double> legDistances;
+	vector<double> legDepartures;
+	RouteObjective legObjective;
+	vector<DeliveryCommand> commands;
+	double totalDistanceTravelled;
+
+	//the rows of the stops in driving order: position, the deliveries, then the depot
+	int stopRow(int stop) const
+	{
+		if (stop == 0)
+			return positionRow;
+		return stop <= (int)deliveryRows.size() ? deliveryRows[stop - 1] : 0;
+	}
+};
+
 class DeliveryPlannerImpl
 {
 public:
@@ -11,37 +58,140 @@ public:
         const GeoCoord& depot,
         const vector<DeliveryRequest>& deliveries,
         vector<DeliveryCommand>& commands,
-        double& totalDistanceTravelled) const;
+        double& totalDistanceTravelled,
+        PlanStats* stats,
+        unsigned int seed) const;
+	void generateDeliveryPlans(const vector<DeliveryJob>& jobs, vector<DeliveryJobResult>& results) const;
+	DeliveryResult generateFleetDeliveryPlan(
+		const GeoCoord& depot,
+		const vector<DeliveryRequest>& deliveries,
+		const FleetOptions& fleet,
+		vector<VehicleCommands>& vehicles) const;
+	void setRouteCache(RouteCache* rc) { cache = rc; }
+	void setSnapDistance(double maxMiles) { snapMiles = maxMiles; }
+	void setObjective(RouteObjective o, double departure) { objective = o; departureTime = departure; }
+	void setAnnealing(const AnnealingOptions& options) { annealing = options; }
+	DeliveryResult generateLivePlan(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+		LivePlanImpl& plan) const;
+	DeliveryResult replanDeliveries(const PlanChange& change, LivePlanImpl& plan) const;
+	DeliveryResult streamDeliveryPlan(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+		const PlanLegCallback& onLeg, double& totalDistanceTravelled) const;
 private:
 	const StreetMap* StreetMapPtr;
+	RouteCache* cache;
+	double snapMiles;
+	RouteObjective objective;
+	double departureTime;
+	AnnealingOptions annealing; //what every optimizer the planner makes is given
+	//move any stop that isn't on the map to the nearest location that is, into copies of depot
+	//and deliveries made only if something moves. Returns how many stops moved, or -1 if one is
+	//further than snapMiles from the map.
+	int snapStops(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+		GeoCoord& snappedDepot, vector<DeliveryRequest>& snappedDeliveries) const;
+	//move the stops onto the map if need be (see snapStops), check them and put the deliveries
+	//in the order that drives least: plannedDepot and optimizedDeliveries are what to route.
+	//The annealing uses seed instead of the planner's own, unless it is 0.
+	DeliveryResult orderStops(
+		const GeoCoord& depot,
+		const vector<DeliveryRequest>& deliveries,
+		GeoCoord& plannedDepot,
+		vector<DeliveryRequest>& optimizedDeliveries,
+		PlanStats* stats,
+		unsigned int seed) const;
+	//check every location is on the map and find the road distances between the depot (row 0)
+	//and every delivery (row i + 1)
+	DeliveryResult measureStops(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+		DistanceMatrix& roads) const;
+	//the commands for driving from the depot to the deliveries in the order given, and back
+	DeliveryResult generateCommands(
+		const GeoCoord& depot,
+		const vector<DeliveryRequest>& optimizedDeliveries,
+		vector<DeliveryCommand>& commands,
+		double& totalDistanceTravelled,
+		PlanStats* stats) const;
+	//append the commands for driving route, which starts at start and passes the deliveries in
+	//the order given; false (appending nothing) if it doesn't reach them all
+	bool describeRoute(
+		const GeoCoord& start,
+		const Route& route2,
+		const vector<DeliveryRequest>& optimizedDeliveries,
+		vector<DeliveryCommand>& commands) const;
+	//the legs of a streamed plan, each routed by whichever thread claims it first. Legs are
+	//claimed in order, so the one the caller is waiting for is either being routed or is next.
+	//The pool's tasks share this with the caller and may start after the plan is done; one that
+	//finds every leg claimed does nothing.
+	struct StreamedLegs
+	{
+		StreamedLegs(int count)
+			: routes(count), results(count, DELIVERY_SUCCESS), distances(count, 0), finished(count, false),
+			finishedCount(0), next(0) {}
+		vector<Route> routes;
+		vector<DeliveryResult> results;
+		vector<double> distances;
+		vector<bool> finished; //guarded by lock, as is finishedCount
+		int finishedCount;
+		atomic<int> next;      //the first leg no thread has claimed
+		mutex lock;
+		condition_variable legFinished;
+	};
+	//route every leg of plan whose ends have changed (keeping the others as they are) and
+	//describe the whole plan again; plan's legs and commands are only replaced if that all works
+	DeliveryResult routeLegs(LivePlanImpl& plan) const;
+	//move single deliveries of plan to wherever in the order they add the least driving
+	static void polishOrder(LivePlanImpl& plan);
+	//drop the rows of plan's distance table that no stop uses any more, if there are enough
+	static void dropUnusedRows(LivePlanImpl& plan);
+	//compass directions, in the order they come round anticlockwise from east
+	enum Heading { EAST, NORTHEAST, NORTH, NORTHWEST, WEST, SOUTHWEST, SOUTH, SOUTHEAST };
 	inline
-	string calculateDirection(double angle) const
+	Heading calculateDirection(double angle) const
 	{
 		if (angle >= 0 && angle < 22.5)
-			return "east";
+			return EAST;
 		else if (angle >= 22.5 && angle < 67.5)
-			return "northeast";
+			return NORTHEAST;
 		else if (angle >= 67.5 && angle < 112.5)
-			return "north";
+			return NORTH;
 		else if (angle >= 112.5 && angle < 157.5)
-			return "northwest";
+			return NORTHWEST;
 		else if (angle >= 157.5 && angle < 202.5)
-			return "west";
+			return WEST;
 		else if (angle >= 202.5 && angle < 247.5)
-			return "southwest";
+			return SOUTHWEST;
 		else if (angle >= 247.5 && angle < 292.5)
-			return "south";
+			return SOUTH;
 		else if (angle >= 292.5 && angle < 337.5)
-			return "southeast";
-		else if (angle >= 337.5)
-			return "east";
-		return "";
+			return SOUTHEAST;
+		return EAST;
 	}
+	//one command, before it has any strings: streets and deliveries are referred to by number
+	enum StepKind { STEP_PROCEED, STEP_TURN_LEFT, STEP_TURN_RIGHT, STEP_DELIVER };
+	struct PlanStep
+	{
+		StepKind kind;
+		Heading heading;  //which way to proceed
+		int street;       //the street to proceed along or turn onto
+		int delivery;     //which of the deliveries to make
+		double distance;  //how far to proceed
+
+		static PlanStep proceed(Heading heading, int street, double distance)
+		{
+			return PlanStep{ STEP_PROCEED, heading, street, -1, distance };
+		}
+		static PlanStep turn(StepKind kind, int street) { return PlanStep{ kind, EAST, street, -1, 0 }; }
+		static PlanStep deliver(int delivery) { return PlanStep{ STEP_DELIVER, EAST, -1, delivery, 0 }; }
+	};
+	static void renderSteps(const StreetGraph& graph, const vector<PlanStep>& steps,
+		const vector<DeliveryRequest>& optimizedDeliveries, vector<DeliveryCommand>& commands);
 };
 
 DeliveryPlannerImpl::DeliveryPlannerImpl(const StreetMap* sm)
 {
 	StreetMapPtr = sm;
+	cache = nullptr;
+	snapMiles = 0;
+	objective = ROUTE_SHORTEST;
+	departureTime = 0;
 }
 
 DeliveryPlannerImpl::~DeliveryPlannerImpl()
@@ -52,143 +202,243 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
     const GeoCoord& depot,
     const vector<DeliveryRequest>& deliveries,
     vector<DeliveryCommand>& commands,
-    double& totalDistanceTravelled) const
+    double& totalDistanceTravelled,
+    PlanStats* stats,
+    unsigned int seed) const
 {
-	//first optimize the delivery requests
+	ScopedTimer timer(stats != nullptr ? &stats->totalMilliseconds : nullptr);
+	GeoCoord plannedDepot;
 	vector<DeliveryRequest> optimizedDeliveries;
+	DeliveryResult ordered = orderStops(depot, deliveries, plannedDepot, optimizedDeliveries, stats, seed);
+	if (ordered != DELIVERY_SUCCESS)
+		return ordered;
 
-	for (int i = 0; i < deliveries.size(); i++)
-		optimizedDeliveries.push_back(deliveries[i]);
+	//with nothing to deliver the driver never leaves the depot
+	if (optimizedDeliveries.empty())
+	{
+		totalDistanceTravelled = 0;
+		return DELIVERY_SUCCESS;
+	}
+	return generateCommands(plannedDepot, optimizedDeliveries, commands, totalDistanceTravelled, stats);
+}
+
+DeliveryResult DeliveryPlannerImpl::orderStops(
+	const GeoCoord& depot,
+	const vector<DeliveryRequest>& deliveries,
+	GeoCoord& plannedDepot,
+	vector<DeliveryRequest>& optimizedDeliveries,
+	PlanStats* stats,
+	unsigned int seed) const
+{
+	DistanceMatrix roads;
+	{
+		ScopedTimer measuring(stats != nullptr ? &stats->measureMilliseconds : nullptr);
+
+		//stops that are just off the map are moved onto it first, if the planner allows that
+		int moved = snapStops(depot, deliveries, plannedDepot, optimizedDeliveries);
+		if (moved < 0)
+			return BAD_COORD;
+		if (moved == 0)
+		{
+			plannedDepot = depot;
+			optimizedDeliveries = deliveries;
+		}
+		DeliveryResult measured = measureStops(plannedDepot, optimizedDeliveries, roads);
+		if (measured != DELIVERY_SUCCESS)
+			return measured;
+	}
+	if (optimizedDeliveries.empty())
+		return DELIVERY_SUCCESS;
 
+	//then optimize the delivery requests, by how far apart they really are by road
 	DeliveryOptimizer DO(StreetMapPtr);
-	double oldCrowDistance, newCrowDistance;
-	DO.optimizeDeliveryOrder(depot, optimizedDeliveries, oldCrowDistance, newCrowDistance);
+	AnnealingOptions options = annealing;
+	if (seed != 0)
+		options.seed = seed;
+	setAnnealingOptions(DO, options);
+	double oldRoadDistance, newRoadDistance;
+	ScopedTimer optimizing(stats != nullptr ? &stats->optimizeMilliseconds : nullptr);
+	optimizeDeliveryOrder(DO, optimizedDeliveries, roads, oldRoadDistance, newRoadDistance,
+		stats != nullptr ? &stats->annealing : nullptr);
+	return DELIVERY_SUCCESS;
+}
 
-	//now generate a route from the depot to all the delivery locations and back to the depot.
-	//add all the individual routes between the delivery points to one long list of street segments
-	//called route2
-	PointToPointRouter p2p(StreetMapPtr);
-	list<StreetSegment> route;
-	list<StreetSegment> route2;
-	const GeoCoord home = depot;
-	totalDistanceTravelled = 0;
+DeliveryResult DeliveryPlannerImpl::measureStops(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+	DistanceMatrix& roads) const
+{
+	//every location has to be on the map before anything gets planned; looking the segments up
+	//as a range means nothing is copied
+	SegmentRange segs;
+	if (!getSegmentsThatStartWith(*StreetMapPtr, depot, segs))
+		return BAD_COORD;
+	for (int i = 0; i < deliveries.size(); i++)
+	{
+		if (!getSegmentsThatStartWith(*StreetMapPtr, deliveries[i].location, segs))
+			return BAD_COORD;
+	}
 
-	//first generate the route from the depot to the first delivery point, and add it to route2
-	p2p.generatePointToPointRoute(home, optimizedDeliveries[0].location, route, totalDistanceTravelled); cerr << "cp1\n";
-	for (auto x = route.begin(); x != route.end(); x++)
-		route2.push_back(*x);
+	//find the distances between every pair of them once, so the optimizer can work from those
+	vector<GeoCoord> stops(1, depot);
+	for (int i = 0; i < deliveries.size(); i++)
+		stops.push_back(deliveries[i].location);
+	return computeDistanceMatrix(*StreetMapPtr, stops, roads);
+}
 
-	//now generate the route between successive delivery locations and back to the depot
-	for (int i = 0; i < optimizedDeliveries.size(); i++)
+int DeliveryPlannerImpl::snapStops(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+	GeoCoord& snappedDepot, vector<DeliveryRequest>& snappedDeliveries) const
+{
+	if (snapMiles <= 0)
+		return 0;
+	const StreetGraph& graph = getStreetGraph(*StreetMapPtr);
+	int moved = 0;
+	//stop -1 is the depot
+	for (int i = -1; i < (int)deliveries.size(); i++)
 	{
-		if (i == optimizedDeliveries.size() - 1)
+		const GeoCoord& gc = (i < 0 ? depot : deliveries[i].location);
+		if (graph.findNode(gc) != -1)
+			continue;
+		GeoCoord onMap;
+		double miles;
+		if (!snapToNearestNode(*StreetMapPtr, gc, onMap, miles) || miles > snapMiles)
+			return -1;
+		if (moved++ == 0)
 		{
-			p2p.generatePointToPointRoute(optimizedDeliveries[i].location, home, route, totalDistanceTravelled);
-			for (auto x = route.begin(); x != route.end(); x++)
-				route2.push_back(*x);
+			snappedDepot = depot;
+			snappedDeliveries = deliveries;
 		}
+		if (i < 0)
+			snappedDepot = onMap;
 		else
-		{
-			p2p.generatePointToPointRoute(optimizedDeliveries[i].location, optimizedDeliveries[i + 1].location, route, totalDistanceTravelled);
-			for (auto x = route.begin(); x != route.end(); x++)
-				route2.push_back(*x);
-		}
+			snappedDeliveries[i].location = onMap;
+	}
+	return moved;
+}
+
+DeliveryResult DeliveryPlannerImpl::generateCommands(
+	const GeoCoord& depot,
+	const vector<DeliveryRequest>& optimizedDeliveries,
+	vector<DeliveryCommand>& commands,
+	double& totalDistanceTravelled,
+	PlanStats* stats) const
+{
+	//now generate a route from the depot to all the delivery locations and back to the depot,
+	//as one long Route called route2
+	PointToPointRouter p2p(StreetMapPtr);
+	useRouteCache(p2p, cache);
+	setRouteObjective(p2p, objective, departureTime);
+	Route route2;
+	vector<GeoCoord> waypoints(1, depot);
+	for (int i = 0; i < optimizedDeliveries.size(); i++)
+		waypoints.push_back(optimizedDeliveries[i].location);
+	waypoints.push_back(depot);
+	vector<LegResult> legs;
+	DeliveryResult routed;
+	{
+		ScopedTimer routing(stats != nullptr ? &stats->routeMilliseconds : nullptr);
+		routed = generateMultiLegRoute(p2p, waypoints, route2, legs, totalDistanceTravelled,
+			stats != nullptr ? &stats->routing : nullptr);
 	}
+	if (routed != DELIVERY_SUCCESS)
+		return routed;
+	ScopedTimer describing(stats != nullptr ? &stats->commandMilliseconds : nullptr);
+	if (!describeRoute(depot, route2, optimizedDeliveries, commands))
+		return NO_ROUTE;
+	return DELIVERY_SUCCESS;
+}
 
+bool DeliveryPlannerImpl::describeRoute(
+	const GeoCoord& start,
+	const Route& route2,
+	const vector<DeliveryRequest>& optimizedDeliveries,
+	vector<DeliveryCommand>& commands) const
+{
+	//where each delivery is, as a node of the map, so that reaching it is just comparing IDs
+	const StreetGraph& graph = getStreetGraph(*StreetMapPtr);
+	static thread_local vector<int> deliveryNodes;
+	deliveryNodes.clear();
+	for (int i = 0; i < optimizedDeliveries.size(); i++)
+		deliveryNodes.push_back(graph.findNode(optimizedDeliveries[i].location));
+
+	//the commands are first worked out as steps that refer to streets and deliveries by number,
+	//and only made into DeliveryCommands (with their strings) once they are all known
+	static thread_local vector<PlanStep> steps;
+	steps.clear();
 	int deliveryNo = 0;
 
 	if (route2.empty()) //eg. if all deliveries are at the depot
 	{
-		while (deliveryNo < optimizedDeliveries.size() && optimizedDeliveries[deliveryNo].location == depot)
+		//by node, like everything else here, since the same place can be written more than one way
+		int startNode = graph.findNode(start);
+		while (deliveryNo < optimizedDeliveries.size() && deliveryNodes[deliveryNo] == startNode)
 		{
-			DeliveryCommand DC;
-			DC.initAsDeliverCommand(optimizedDeliveries[deliveryNo].item);
-			commands.push_back(DC);
+			steps.push_back(PlanStep::deliver(deliveryNo));
 			deliveryNo++;
 		}
-		return DELIVERY_SUCCESS;
+		if (deliveryNo < optimizedDeliveries.size())
+			return false;
+		renderSteps(graph, steps, optimizedDeliveries, commands);
+		return true;
 	}
 
-	list<StreetSegment>::iterator it = route2.begin();
-	list<StreetSegment>::iterator temp = ++it;
-	it--; //temp is one street segment ahead of it
+	int it = 0;
+	int temp = 1; //temp is one street segment ahead of it
 
-	string streetName;
-	string dir;
+	Heading dir = EAST;
 	double dist = 0;
 	bool firstSegment = true; //tells us if the present street segment is the first of the street
 							  //helps us determine the direction for the proceed command
 
-	while (temp != route2.end()) 
+	while (temp != route2.size()) 
 	{
-		DeliveryCommand DC;
-		
 		//if a delivery is to be made at the start of this street segment
-		if (optimizedDeliveries[deliveryNo].location == it->start)
+		if (deliveryNo < optimizedDeliveries.size() && deliveryNodes[deliveryNo] == route2[it].startNode())
 		{
 			//if some distance was travelled on the street to get to the delivery point
 			//as opposed to a delivery being just after turning onto a new street
 			//give the proceed command followed by the delivery command
 			if (dist != 0) 
 			{
-				DC.initAsProceedCommand(dir, (*it).name, dist);
-				commands.push_back(DC);
-				cerr << "\nI AM DELIVERING SOMETHING////////////////////\n";
+				steps.push_back(PlanStep::proceed(dir, route2[it].street(), dist));
 				dist = 0;
 			}
 
 			firstSegment = true; 
 
-			DC.initAsDeliverCommand(optimizedDeliveries[deliveryNo].item);
-			commands.push_back(DC);
-
-			if (deliveryNo < optimizedDeliveries.size())
-				deliveryNo++;
+			steps.push_back(PlanStep::deliver(deliveryNo));
+			deliveryNo++;
 
 			//if there are multiple deliveries in the same location
-			while (deliveryNo < optimizedDeliveries.size())
+			while (deliveryNo < optimizedDeliveries.size() && deliveryNodes[deliveryNo] == route2[it].startNode())
 			{
-				if (optimizedDeliveries[deliveryNo].location == it->start)
-				{
-					DC.initAsDeliverCommand(optimizedDeliveries[deliveryNo].item);
-					commands.push_back(DC); 
-					cerr << "\nI AM DELIVERING SOMETHING////////////////////\n";
-					deliveryNo++;
-				}
-				else
-					break;
+				steps.push_back(PlanStep::deliver(deliveryNo));
+				deliveryNo++;
 			}
 		}
-		if (it->name == temp->name)
+		if (route2[it].street() == route2[temp].street())
 		{
 			//if the street segments pointed to by both iterators are the same i.e. we are on the same street
 			//only calculate the direction based on the direction of the first street segment.
 			if (firstSegment)
 			{
 				firstSegment = false;
-				double angle = angleOfLine(*it);
-				dir = calculateDirection(angle);
+				dir = calculateDirection(route2[it].bearing());
 			}
-			dist += distanceEarthMiles(it->start, it->end); 
+			dist += route2[it].length(); 
 		}
-		else if (it->name != temp->name)
+		else
 		{
 			if (firstSegment)
-			{
-				double angle3 = angleOfLine(*it);
-				dir = calculateDirection(angle3);
-			}
+				dir = calculateDirection(route2[it].bearing());
 			
 			//since the two street segments don't belong to the same street, give the proceed command
 			//based on the cumulative distance travelled until now
-			DC.initAsProceedCommand(dir, it->name, dist + distanceEarthMiles(it->start, it->end));
-			commands.push_back(DC);
+			steps.push_back(PlanStep::proceed(dir, route2[it].street(), dist + route2[it].length()));
 			firstSegment = true; //this is true because the next street segment that we move onto 
 								 //will be the first of that street
 
 			//if there is a delivery to be made on the next street segment, skip the rest of the steps
 			//i.e. don't turn
-			if (temp->start == optimizedDeliveries[deliveryNo].location)
+			if (deliveryNo < optimizedDeliveries.size() && route2[temp].startNode() == deliveryNodes[deliveryNo])
 			{
 				dist = 0;
 				it++;
@@ -197,27 +447,16 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
 			}
 
 			//decide which direction to turn in or proceed
-			double angle = angleBetween2Lines(*it, *temp);
+			double angle = route2[it].angleTo(route2[temp]);
 			if (angle < 1 || angle > 359)
 			{
-				double angle2 = angleOfLine(*temp);
-				dir = calculateDirection(angle2);
-
+				dir = calculateDirection(route2[temp].bearing());
 				firstSegment = false;
 			}
-			else if (angle >= 1 && angle < 180)
+			else
 			{
-				DeliveryCommand DC2;
-				DC2.initAsTurnCommand("left", temp->name); 
-				commands.push_back(DC2);
-				dir = calculateDirection(angleOfLine(*temp));
-			}
-			else if (angle >= 180 && angle <= 359)
-			{
-				DeliveryCommand DC2; 
-				DC2.initAsTurnCommand("right", temp->name);
-				commands.push_back(DC2);
-				dir = calculateDirection(angleOfLine(*temp));
+				steps.push_back(PlanStep::turn(angle < 180 ? STEP_TURN_LEFT : STEP_TURN_RIGHT, route2[temp].street()));
+				dir = calculateDirection(route2[temp].bearing());
 			}
 			dist = 0;
 		}
@@ -225,55 +464,593 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
 		temp++;
 	}
 
-	//since the while loop runs until temp is just past the end, and because iterator
-	//temp is one street segment ahead of iterator it, the last segment of the route remains unevaluated
-	DeliveryCommand lastleg;
+	//since the while loop runs until temp is just past the end, and because
+	//temp is one street segment ahead of it, the last segment of the route remains unevaluated
 	bool firstProceed = true;
+	if (firstSegment) //eg. if the route is a single segment, the loop never worked out its direction
+		dir = calculateDirection(route2[it].bearing());
 
 	//if there are any deliveries left, they are either at the start of the last segment or the end
 	if (deliveryNo < optimizedDeliveries.size())
 	{
 		while (deliveryNo < optimizedDeliveries.size())
 		{
-			if (optimizedDeliveries[deliveryNo].location == it->start) 
+			if (deliveryNodes[deliveryNo] == route2[it].startNode()) 
 			{
-				lastleg.initAsDeliverCommand(optimizedDeliveries[deliveryNo].item);
-				commands.push_back(lastleg);
+				//as in the loop: finish proceeding along the street before delivering, and set
+				//off along the last segment afresh afterwards
+				if (dist != 0)
+					steps.push_back(PlanStep::proceed(dir, route2[it].street(), dist));
+				dist = 0;
+				dir = calculateDirection(route2[it].bearing());
+				steps.push_back(PlanStep::deliver(deliveryNo));
 				deliveryNo++;
-				cerr << "\nI AM DELIVERING SOMETHING//////////////////// LAST LEG start\n";
 				if (deliveryNo == optimizedDeliveries.size())
-				{
-					double angle = angleOfLine(*it);
-					string newdir = calculateDirection(angle);
-					lastleg.initAsProceedCommand(newdir, it->name, distanceEarthMiles(it->start, it->end));
-					commands.push_back(lastleg);
-				}
+					steps.push_back(PlanStep::proceed(dir, route2[it].street(), route2[it].length()));
 			}
-			else if (optimizedDeliveries[deliveryNo].location == it->end) 
+			else if (deliveryNodes[deliveryNo] == route2[it].endNode()) 
 			{
 				if (firstProceed)
 				{
-					lastleg.initAsProceedCommand(dir, it->name, dist + distanceEarthMiles(it->start, it->end));
-					commands.push_back(lastleg);
+					steps.push_back(PlanStep::proceed(dir, route2[it].street(), dist + route2[it].length()));
 					firstProceed = false;
 				}
-				lastleg.initAsDeliverCommand(optimizedDeliveries[deliveryNo].item);
-				commands.push_back(lastleg);
-				cerr << "\nI AM DELIVERING SOMETHING//////////////////// LAST LEG end\n";
+				steps.push_back(PlanStep::deliver(deliveryNo));
 				deliveryNo++;
 			}
+			else
+				return false; //the route went past this delivery without stopping
+		}
+	}
+	else
+		steps.push_back(PlanStep::proceed(dir, route2[it].street(), dist + route2[it].length()));
+
+	renderSteps(graph, steps, optimizedDeliveries, commands);
+	return true;
+
+	//if it's it->start, you need to give proceed commands for the last leg. if it's it->end, you need to just not do anything
+	//check if your turns are taken care of in the last leg
+}
+
+//append the steps just worked out to commands, which only now get their strings
+void DeliveryPlannerImpl::renderSteps(const StreetGraph& graph, const vector<PlanStep>& steps,
+	const vector<DeliveryRequest>& optimizedDeliveries, vector<DeliveryCommand>& commands)
+{
+	static const char* const headingNames[] =
+		{ "east", "northeast", "north", "northwest", "west", "southwest", "south", "southeast" };
+	commands.reserve(commands.size() + steps.size());
+	for (int i = 0; i < steps.size(); i++)
+	{
+		const PlanStep& step = steps[i];
+		DeliveryCommand DC;
+		switch (step.kind)
+		{
+		case STEP_PROCEED:
+			DC.initAsProceedCommand(headingNames[step.heading], graph.streetName(step.street), step.distance);
+			break;
+		case STEP_TURN_LEFT:
+			DC.initAsTurnCommand("left", graph.streetName(step.street));
+			break;
+		case STEP_TURN_RIGHT:
+			DC.initAsTurnCommand("right", graph.streetName(step.street));
+			break;
+		case STEP_DELIVER:
+			DC.initAsDeliverCommand(optimizedDeliveries[step.delivery].item);
+			break;
+		}
+		commands.push_back(DC);
+	}
+}
+
+DeliveryResult DeliveryPlannerImpl::generateLivePlan(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+	LivePlanImpl& plan) const
+{
+	GeoCoord snappedDepot;
+	vector<DeliveryRequest> snappedDeliveries;
+	int moved = snapStops(depot, deliveries, snappedDepot, snappedDeliveries);
+	if (moved < 0)
+		return BAD_COORD;
+	if (moved > 0)
+		return generateLivePlan(snappedDepot, snappedDeliveries, plan);
+
+	//order the deliveries exactly as generateDeliveryPlan does, keeping the distance table
+	DistanceMatrix roads;
+	DeliveryResult measured = measureStops(depot, deliveries, roads);
+	if (measured != DELIVERY_SUCCESS)
+		return measured;
+	vector<DeliveryRequest> optimizedDeliveries = deliveries;
+	if (!deliveries.empty())
+	{
+		DeliveryOptimizer DO(StreetMapPtr);
+		setAnnealingOptions(DO, annealing);
+		double oldRoadDistance, newRoadDistance;
+		optimizeDeliveryOrder(DO, optimizedDeliveries, roads, oldRoadDistance, newRoadDistance);
+	}
+
+	//build the plan aside, so a failure leaves the one there was
+	LivePlanImpl updated;
+	updated.depot = depot;
+	updated.position = depot;
+	updated.clock = departureTime;
+	updated.points.push_back(depot);
+	for (int i = 0; i < deliveries.size(); i++)
+		updated.points.push_back(deliveries[i].location);
+	updated.roads = roads;
+	updated.positionRow = 0;
+	//the optimizer only hands the deliveries back, reordered; deliveries at the same place have
+	//the same distances, so any row for the place will do
+	const StreetGraph& graph = getStreetGraph(*StreetMapPtr);
+	vector<bool> taken(deliveries.size(), false);
+	for (int i = 0; i < optimizedDeliveries.size(); i++)
+	{
+		int node = graph.findNode(optimizedDeliveries[i].location);
+		int row = 0;
+		for (int j = 0; j < deliveries.size(); j++)
+		{
+			if (!taken[j] && graph.findNode(deliveries[j].location) == node)
+			{
+				taken[j] = true;
+				row = j + 1;
+				break;
+			}
+		}
+		updated.deliveryRows.push_back(row);
+	}
+	updated.deliveries.swap(optimizedDeliveries);
+	DeliveryResult routed = routeLegs(updated);
+	if (routed == DELIVERY_SUCCESS)
+		plan = move(updated);
+	return routed;
+}
+
+DeliveryResult DeliveryPlannerImpl::replanDeliveries(const PlanChange& change, LivePlanImpl& plan) const
+{
+	//the new locations are moved onto the map if need be (a driver's position is often a raw
+	//GPS fix), then checked, before anything changes
+	GeoCoord position = (change.moved ? change.position : plan.position);
+	GeoCoord snappedPosition;
+	vector<DeliveryRequest> added;
+	int moved = snapStops(position, change.added, snappedPosition, added);
+	if (moved < 0)
+		return BAD_COORD;
+	if (moved > 0)
+		position = snappedPosition;
+	else
+		added = change.added;
+	const StreetGraph& graph = getStreetGraph(*StreetMapPtr);
+	if (change.moved && graph.findNode(position) == -1)
+		return BAD_COORD;
+	for (int i = 0; i < added.size(); i++)
+		if (graph.findNode(added[i].location) == -1)
+			return BAD_COORD;
+
+	//make the change to a copy, which only replaces plan once its legs are routed and described
+	LivePlanImpl updated = plan;
+
+	//one search from each new location gives its distances to and from every other
+	int known = (int)updated.points.size();
+	if (change.moved)
+		updated.points.push_back(position);
+	for (int i = 0; i < added.size(); i++)
+		updated.points.push_back(added[i].location);
+	DeliveryResult measured = extendDistanceMatrix(*StreetMapPtr, updated.points, known, updated.roads);
+	if (measured != DELIVERY_SUCCESS)
+		return measured;
+	int nextRow = known;
+
+	//the driver has made the first deliveries, and is where the last of them was or somewhere new;
+	//unless the change says what time it is, it's when the plan had them reaching that place
+	int completed = max(0, min(change.completed, (int)updated.deliveries.size()));
+	if (completed > 0)
+	{
+		updated.position = updated.deliveries[completed - 1].location;
+		updated.positionRow = updated.deliveryRows[completed - 1];
+		updated.clock = updated.legDepartures[completed];
+		updated.deliveries.erase(updated.deliveries.begin(), updated.deliveries.begin() + completed);
+		updated.deliveryRows.erase(updated.deliveryRows.begin(), updated.deliveryRows.begin() + completed);
+	}
+	if (change.moved)
+	{
+		updated.position = position;
+		updated.positionRow = nextRow++;
+	}
+	if (change.now >= 0)
+		updated.clock = change.now;
+
+	for (int c = 0; c < change.cancelled.size(); c++)
+	{
+		for (int i = 0; i < updated.deliveries.size(); i++)
+		{
+			if (updated.deliveries[i].item == change.cancelled[c])
+			{
+				updated.deliveries.erase(updated.deliveries.begin() + i);
+				updated.deliveryRows.erase(updated.deliveryRows.begin() + i);
+				break;
+			}
+		}
+	}
+
+	//cheapest insertion: each new delivery goes between the two stops it lengthens the drive
+	//between the least
+	const DistanceMatrix& roads = updated.roads;
+	for (int a = 0; a < added.size(); a++)
+	{
+		int row = nextRow++;
+		int bestStop = 0;
+		double bestCost = 0;
+		for (int stop = 0; stop <= updated.deliveries.size(); stop++)
+		{
+			int from = updated.stopRow(stop), to = updated.stopRow(stop + 1);
+			double cost = roads.at(from, row) + roads.at(row, to) - roads.at(from, to);
+			if (stop == 0 || cost < bestCost)
+			{
+				bestStop = stop;
+				bestCost = cost;
+			}
+		}
+		updated.deliveries.insert(updated.deliveries.begin() + bestStop, added[a]);
+		updated.deliveryRows.insert(updated.deliveryRows.begin() + bestStop, row);
+	}
+
+	polishOrder(updated);
+	dropUnusedRows(updated);
+	DeliveryResult routed = routeLegs(updated);
+	if (routed == DELIVERY_SUCCESS)
+		plan = move(updated);
+	return routed;
+}
+
+void DeliveryPlannerImpl::polishOrder(LivePlanImpl& plan)
+{
+	//a few passes are enough to undo what the insertions got wrong; a full optimization is
+	//what generateLivePlan is for
+	const int passes = 3;
+	const DistanceMatrix& roads = plan.roads;
+	vector<int>& rows = plan.deliveryRows;
+	int n = (int)rows.size();
+	for (int pass = 0; pass < passes; pass++)
+	{
+		bool improved = false;
+		for (int i = 0; i < n; i++)
+		{
+			//what taking delivery i out of the order saves (stop i + 1 is delivery i)
+			int before = plan.stopRow(i), row = rows[i], after = plan.stopRow(i + 2);
+			double saved = roads.at(before, row) + roads.at(row, after) - roads.at(before, after);
+
+			//and where putting it back costs least, as a place in the order without it
+			int bestPlace = i;
+			double bestCost = saved;
+			for (int place = 0; place < n; place++)
+			{
+				if (place == i)
+					continue;
+				//with i taken out, the stops either side of place are these
+				int from = plan.stopRow(place < i ? place : place + 1);
+				int to = plan.stopRow(place < i ? place + 1 : place + 2);
+				double cost = roads.at(from, row) + roads.at(row, to) - roads.at(from, to);
+				if (cost < bestCost - 1e-9)
+				{
+					bestPlace = place;
+					bestCost = cost;
+				}
+			}
+			if (bestPlace == i)
+				continue;
+
+			DeliveryRequest moving = plan.deliveries[i];
+			plan.deliveries.erase(plan.deliveries.begin() + i);
+			rows.erase(rows.begin() + i);
+			plan.deliveries.insert(plan.deliveries.begin() + bestPlace, moving);
+			rows.insert(rows.begin() + bestPlace, row);
+			improved = true;
+		}
+		if (!improved)
+			break;
+	}
+}
+
+void DeliveryPlannerImpl::dropUnusedRows(LivePlanImpl& plan)
+{
+	int live = (int)plan.deliveryRows.size() + 2;
+	if ((int)plan.points.size() <= 2 * live + 16)
+		return;
+
+	//copy the rows still in use into a new table, in the order the stops come
+	vector<int> oldRows;
+	oldRows.push_back(0);
+	oldRows.push_back(plan.positionRow);
+	for (int i = 0; i < plan.deliveryRows.size(); i++)
+		oldRows.push_back(plan.deliveryRows[i]);
+	vector<int> newRow(plan.points.size(), -1);
+	vector<GeoCoord> points;
+	for (int i = 0; i < oldRows.size(); i++)
+	{
+		if (newRow[oldRows[i]] == -1)
+		{
+			newRow[oldRows[i]] = (int)points.size();
+			points.push_back(plan.points[oldRows[i]]);
+		}
+	}
+	DistanceMatrix roads;
+	roads.resize((int)points.size());
+	for (int from = 0; from < plan.points.size(); from++)
+		for (int to = 0; to < plan.points.size(); to++)
+			if (newRow[from] != -1 && newRow[to] != -1)
+				roads.set(newRow[from], newRow[to], plan.roads.at(from, to));
+
+	plan.points.swap(points);
+	plan.roads = roads;
+	plan.positionRow = newRow[plan.positionRow];
+	for (int i = 0; i < plan.deliveryRows.size(); i++)
+		plan.deliveryRows[i] = newRow[plan.deliveryRows[i]];
+	//legs between rows that are gone can't be kept anyway
+	for (int i = 0; i < plan.legRows.size(); i++)
+	{
+		int from = newRow[plan.legRows[i].first], to = newRow[plan.legRows[i].second];
+		plan.legRows[i] = (from == -1 || to == -1 ? make_pair(-1, -1) : make_pair(from, to));
+	}
+}
+
+DeliveryResult DeliveryPlannerImpl::routeLegs(LivePlanImpl& plan) const
+{
+	//a leg between the same two rows as before is the same drive, so it keeps its route. A
+	//fastest route also depends on when it sets off, so that has to be the same too.
+	map<pair<int, int>, int> oldLegs;
+	if (plan.legObjective == objective)
+		for (int i = 0; i < plan.legRows.size(); i++)
+			oldLegs[plan.legRows[i]] = i;
+	int legCount = (int)plan.deliveries.size() + 1;
+	vector<Route> legs(legCount);
+	vector<pair<int, int>> legRows(legCount);
+	vector<double> legDistances(legCount, 0);
+	vector<double> legDepartures(legCount, plan.clock);
+	vector<bool> kept(legCount, false);
+	for (int i = 0; i < legCount; i++)
+	{
+		legRows[i] = make_pair(plan.stopRow(i), plan.stopRow(i + 1));
+		map<pair<int, int>, int>::const_iterator old = oldLegs.find(legRows[i]);
+		if (old != oldLegs.end())
+		{
+			legs[i] = plan.legs[old->second];
+			legDistances[i] = plan.legDistances[old->second];
+			kept[i] = true;
+		}
+	}
+
+	PointToPointRouter p2p(StreetMapPtr);
+	useRouteCache(p2p, cache);
+	const TravelTimes& times = getTravelTimes(*StreetMapPtr);
+	if (objective == ROUTE_FASTEST)
+	{
+		//each leg sets off when the one before arrives, as generateDeliveryPlan's legs do, so
+		//these have to be routed one after another
+		double clock = plan.clock;
+		for (int i = 0; i < legCount; i++)
+		{
+			legDepartures[i] = clock;
+			if (kept[i] && plan.legDepartures[oldLegs[legRows[i]]] != clock)
+				kept[i] = false;
+			if (!kept[i])
+			{
+				setRouteObjective(p2p, objective, clock);
+				legDistances[i] = 0;
+				DeliveryResult result = generatePointToPointRoute(p2p, plan.points[legRows[i].first],
+					plan.points[legRows[i].second], legs[i], legDistances[i]);
+				if (result != DELIVERY_SUCCESS)
+					return result;
+			}
+			clock += times.hoursFor(legs[i], clock);
 		}
 	}
 	else
 	{
-		lastleg.initAsProceedCommand(dir, it->name, dist + distanceEarthMiles(it->start, it->end));
-		commands.push_back(lastleg);
+		//the new legs don't depend on each other, so route them all at once
+		vector<int> toRoute;
+		for (int i = 0; i < legCount; i++)
+			if (!kept[i])
+				toRoute.push_back(i);
+		setRouteObjective(p2p, objective, departureTime);
+		vector<DeliveryResult> results(toRoute.size(), DELIVERY_SUCCESS);
+		ThreadPool::shared().parallelFor((int)toRoute.size(), [&](int k) {
+			int i = toRoute[k];
+			results[k] = generatePointToPointRoute(p2p, plan.points[legRows[i].first], plan.points[legRows[i].second],
+				legs[i], legDistances[i]);
+		});
+		for (int k = 0; k < results.size(); k++)
+			if (results[k] != DELIVERY_SUCCESS)
+				return results[k];
+		//still worth knowing when each leg sets off, for when the driver has made deliveries
+		for (int i = 1; i < legCount; i++)
+			legDepartures[i] = legDepartures[i - 1] + times.hoursFor(legs[i - 1], legDepartures[i - 1]);
+	}
+
+	//the commands are cheap to make compared to routing, so describe the whole plan again
+	const StreetGraph& graph = getStreetGraph(*StreetMapPtr);
+	Route whole;
+	whole.begin(&graph, graph.findNode(plan.position));
+	double totalDistanceTravelled = 0;
+	for (int i = 0; i < legCount; i++)
+	{
+		whole.append(legs[i]);
+		totalDistanceTravelled += legDistances[i];
 	}
-	cerr<<"Ignore everything until here.....\n///////////\n////////////////////////////////////////////////\n";
+	vector<DeliveryCommand> commands;
+	if (!describeRoute(plan.position, whole, plan.deliveries, commands))
+		return NO_ROUTE;
+
+	plan.legs.swap(legs);
+	plan.legRows.swap(legRows);
+	plan.legDistances.swap(legDistances);
+	plan.legDepartures.swap(legDepartures);
+	plan.legObjective = objective;
+	plan.commands.swap(commands);
+	plan.totalDistanceTravelled = totalDistanceTravelled;
 	return DELIVERY_SUCCESS;
+}
 
-	//if it's it->start, you need to give proceed commands for the last leg. if it's it->end, you need to just not do anything
-	//check if your turns are taken care of in the last leg
+DeliveryResult DeliveryPlannerImpl::generateFleetDeliveryPlan(
+	const GeoCoord& depot,
+	const vector<DeliveryRequest>& deliveries,
+	const FleetOptions& fleet,
+	vector<VehicleCommands>& vehicles) const
+{
+	//weights has to give one weight per delivery, or none at all
+	if (!fleet.weights.empty() && fleet.weights.size() != deliveries.size())
+		return NO_ROUTE;
+
+	GeoCoord snappedDepot;
+	vector<DeliveryRequest> snappedDeliveries;
+	int moved = snapStops(depot, deliveries, snappedDepot, snappedDeliveries);
+	if (moved < 0)
+		return BAD_COORD;
+	if (moved > 0)
+		return generateFleetDeliveryPlan(snappedDepot, snappedDeliveries, fleet, vehicles);
+
+	DistanceMatrix roads;
+	DeliveryResult measured = measureStops(depot, deliveries, roads);
+	if (measured != DELIVERY_SUCCESS)
+		return measured;
+
+	//split the deliveries into trips and share those out between the vehicles
+	DeliveryOptimizer DO(StreetMapPtr);
+	setAnnealingOptions(DO, annealing);
+	vector<VehiclePlan> plans;
+	if (!optimizeFleetDeliveryOrder(DO, deliveries, roads, fleet, plans))
+		return NO_ROUTE;
+
+	//each vehicle's commands are those of its trips one after another, every trip starting and
+	//ending at the depot. The trips don't depend on each other, so make them all at once.
+	vector<pair<int, int>> trips; //(vehicle, trip)
+	for (int v = 0; v < plans.size(); v++)
+		for (int t = 0; t < plans[v].trips.size(); t++)
+			trips.push_back(make_pair(v, t));
+	vector<vector<DeliveryCommand>> tripCommands(trips.size());
+	vector<double> tripDistances(trips.size(), 0);
+	vector<DeliveryResult> tripResults(trips.size(), DELIVERY_SUCCESS);
+	ThreadPool::shared().parallelFor((int)trips.size(), [&](int i) {
+		tripResults[i] = generateCommands(depot, plans[trips[i].first].trips[trips[i].second],
+			tripCommands[i], tripDistances[i], nullptr);
+	});
+
+	vehicles.assign(plans.size(), VehicleCommands());
+	for (int i = 0; i < trips.size(); i++)
+	{
+		if (tripResults[i] != DELIVERY_SUCCESS)
+			return tripResults[i];
+		VehicleCommands& vehicle = vehicles[trips[i].first];
+		vehicle.commands.insert(vehicle.commands.end(), tripCommands[i].begin(), tripCommands[i].end());
+		vehicle.totalDistanceTravelled += tripDistances[i];
+	}
+	return DELIVERY_SUCCESS;
+}
+
+DeliveryResult DeliveryPlannerImpl::streamDeliveryPlan(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+	const PlanLegCallback& onLeg, double& totalDistanceTravelled) const
+{
+	totalDistanceTravelled = 0;
+	GeoCoord plannedDepot;
+	vector<DeliveryRequest> optimizedDeliveries;
+	DeliveryResult ordered = orderStops(depot, deliveries, plannedDepot, optimizedDeliveries, nullptr, 0);
+	if (ordered != DELIVERY_SUCCESS || optimizedDeliveries.empty())
+		return ordered;
+
+	//leg i goes from stop i to stop i + 1: the depot, each delivery in turn, then the depot again
+	vector<GeoCoord> stops(1, plannedDepot);
+	for (int i = 0; i < optimizedDeliveries.size(); i++)
+		stops.push_back(optimizedDeliveries[i].location);
+	stops.push_back(plannedDepot);
+	int legCount = (int)stops.size() - 1;
+
+	PointToPointRouter p2p(StreetMapPtr);
+	useRouteCache(p2p, cache);
+	setRouteObjective(p2p, objective, departureTime);
+	shared_ptr<StreamedLegs> legs = make_shared<StreamedLegs>(legCount);
+	auto routeLeg = [&p2p, &stops](StreamedLegs& legs, int i) {
+		legs.results[i] = generatePointToPointRoute(p2p, stops[i], stops[i + 1], legs.routes[i], legs.distances[i]);
+		lock_guard<mutex> guard(legs.lock);
+		legs.finished[i] = true;
+		legs.finishedCount++;
+		legs.legFinished.notify_all();
+	};
+
+	//the first leg is routed right here, so its commands go out as soon as possible, while the
+	//pool routes the rest in order. A fastest route depends on when its leg sets off, so those
+	//are all routed here, one after another, as the one before is handed over.
+	legs->next = 1;
+	if (objective != ROUTE_FASTEST)
+	{
+		auto routeRest = [legs, routeLeg, legCount]() {
+			for (int i = legs->next++; i < legCount; i = legs->next++)
+				routeLeg(*legs, i);
+		};
+		int helpers = min(legCount - 1, ThreadPool::shared().threadCount());
+		for (int h = 0; h < helpers; h++)
+			ThreadPool::shared().submit(routeRest);
+	}
+
+	const TravelTimes& times = getTravelTimes(*StreetMapPtr);
+	double clock = departureTime;
+	DeliveryResult result = DELIVERY_SUCCESS;
+	vector<DeliveryRequest> arriving;
+	vector<DeliveryCommand> commands;
+	for (int i = 0; i < legCount; i++)
+	{
+		//route the leg here if no thread has started on it yet, otherwise wait for it
+		int unclaimed = i;
+		if (i == 0 || legs->next.compare_exchange_strong(unclaimed, i + 1))
+		{
+			if (objective == ROUTE_FASTEST)
+				setRouteObjective(p2p, objective, clock);
+			routeLeg(*legs, i);
+		}
+		else
+		{
+			unique_lock<mutex> guard(legs->lock);
+			legs->legFinished.wait(guard, [&]() { return legs->finished[i]; });
+		}
+		if (legs->results[i] != DELIVERY_SUCCESS)
+		{
+			result = legs->results[i];
+			break;
+		}
+		clock += times.hoursFor(legs->routes[i], clock);
+		totalDistanceTravelled += legs->distances[i];
+
+		//each leg but the last ends with its delivery
+		arriving.clear();
+		if (i < optimizedDeliveries.size())
+			arriving.push_back(optimizedDeliveries[i]);
+		commands.clear();
+		if (!describeRoute(stops[i], legs->routes[i], arriving, commands))
+		{
+			result = NO_ROUTE;
+			break;
+		}
+		onLeg(i, legCount, commands);
+	}
+
+	//stop any legs nobody has started, and wait for those still being routed, which use p2p
+	int claimed = min(legCount, legs->next.exchange(legCount));
+	unique_lock<mutex> guard(legs->lock);
+	legs->legFinished.wait(guard, [&]() { return legs->finishedCount == claimed; });
+	return result;
+}
+
+void DeliveryPlannerImpl::generateDeliveryPlans(const vector<DeliveryJob>& jobs, vector<DeliveryJobResult>& results) const
+{
+	//every plan only reads the map and makes its own optimizer and router, so the jobs can
+	//all run at once; the pool's workers steal jobs from each other when some take longer
+	//each job's seed is settled here, rather than left for the optimizer to pick, so that it can
+	//be handed back and the job planned again exactly the same way
+	results.assign(jobs.size(), DeliveryJobResult());
+	ThreadPool::shared().parallelFor((int)jobs.size(), [&](int i) {
+		unsigned int seed = (jobs[i].seed != 0 ? jobs[i].seed : annealing.seed);
+		while (seed == 0)
+			seed = random_device()();
+		results[i].seed = seed;
+		results[i].result = generateDeliveryPlan(jobs[i].depot, jobs[i].deliveries,
+			results[i].commands, results[i].totalDistanceTravelled, &results[i].stats, seed);
+	});
 }
 
 //******************** DeliveryPlanner functions ******************************
@@ -297,5 +1074,95 @@ DeliveryResult DeliveryPlanner::generateDeliveryPlan(
     vector<DeliveryCommand>& commands,
     double& totalDistanceTravelled) const
 {
-    return m_impl->generateDeliveryPlan(depot, deliveries, commands, totalDistanceTravelled);
+    return m_impl->generateDeliveryPlan(depot, deliveries, commands, totalDistanceTravelled, nullptr, 0);
+}
+
+DeliveryResult generateDeliveryPlan(const DeliveryPlanner& planner, const GeoCoord& depot,
+	const vector<DeliveryRequest>& deliveries, vector<DeliveryCommand>& commands,
+	double& totalDistanceTravelled, PlanStats& stats)
+{
+	stats = PlanStats();
+	return implOf<DeliveryPlannerImpl>(planner)->generateDeliveryPlan(depot, deliveries, commands,
+		totalDistanceTravelled, &stats, 0);
+}
+
+void generateDeliveryPlans(const DeliveryPlanner& planner, const vector<DeliveryJob>& jobs,
+	vector<DeliveryJobResult>& results)
+{
+	implOf<DeliveryPlannerImpl>(planner)->generateDeliveryPlans(jobs, results);
+}
+
+DeliveryResult generateFleetDeliveryPlan(const DeliveryPlanner& planner, const GeoCoord& depot,
+	const vector<DeliveryRequest>& deliveries, const FleetOptions& fleet, vector<VehicleCommands>& vehicles)
+{
+	return implOf<DeliveryPlannerImpl>(planner)->generateFleetDeliveryPlan(depot, deliveries, fleet, vehicles);
+}
+
+DeliveryResult streamDeliveryPlan(const DeliveryPlanner& planner, const GeoCoord& depot,
+	const vector<DeliveryRequest>& deliveries, const PlanLegCallback& onLeg, double& totalDistanceTravelled)
+{
+	return implOf<DeliveryPlannerImpl>(planner)->streamDeliveryPlan(depot, deliveries, onLeg, totalDistanceTravelled);
+}
+
+void useRouteCache(DeliveryPlanner& planner, RouteCache* cache)
+{
+	implOf<DeliveryPlannerImpl>(planner)->setRouteCache(cache);
+}
+
+void setSnapDistance(DeliveryPlanner& planner, double maxMiles)
+{
+	implOf<DeliveryPlannerImpl>(planner)->setSnapDistance(maxMiles);
+}
+
+DeliveryResult generateLivePlan(const DeliveryPlanner& planner, const GeoCoord& depot,
+	const vector<DeliveryRequest>& deliveries, LivePlan& plan)
+{
+	return implOf<DeliveryPlannerImpl>(planner)->generateLivePlan(depot, deliveries, *implOf<LivePlanImpl>(plan));
+}
+
+DeliveryResult replanDeliveries(const DeliveryPlanner& planner, const PlanChange& change, LivePlan& plan)
+{
+	return implOf<DeliveryPlannerImpl>(planner)->replanDeliveries(change, *implOf<LivePlanImpl>(plan));
+}
+
+void setRouteObjective(DeliveryPlanner& planner, RouteObjective objective, double departureTime)
+{
+	implOf<DeliveryPlannerImpl>(planner)->setObjective(objective, departureTime);
+}
+
+void setAnnealingOptions(DeliveryPlanner& planner, const AnnealingOptions& options)
+{
+	implOf<DeliveryPlannerImpl>(planner)->setAnnealing(options);
+}
+
+//******************** LivePlan functions *************************************
+
+LivePlan::LivePlan()
+{
+	m_impl = new LivePlanImpl;
+}
+
+LivePlan::~LivePlan()
+{
+	delete m_impl;
+}
+
+const GeoCoord& LivePlan::position() const
+{
+	return m_impl->position;
+}
+
+const vector<DeliveryRequest>& LivePlan::deliveries() const
+{
+	return m_impl->deliveries;
+}
+
+const vector<DeliveryCommand>& LivePlan::commands() const
+{
+	return m_impl->commands;
+}
+
+double LivePlan::totalDistanceTravelled() const
+{
+	return m_impl->totalDistanceTravelled;
 }
@@ -0,0 +1,158 @@
+#include "provided.h"
+#include "support.h"
+#include "ThreadPool.h"
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <atomic>
+using namespace std;
+
+namespace
+{
+	typedef pair<double, int> QueueEntry;
+
+	//what the search for one row keeps about each node. A workspace is kept and reused for every
+	//row filled on its thread, so instead of clearing its arrays each search has a new number,
+	//and a node's entries only count if they were written by the current search.
+	struct RowSearch
+	{
+		RowSearch() : search(0) {}
+		void begin(int nodeCount)
+		{
+			if ((int)reachedIn.size() != nodeCount || ++search == 0)
+			{
+				//a different map, or the search numbers ran out: start the arrays afresh
+				distanceTo.assign(nodeCount, 0);
+				reachedIn.assign(nodeCount, 0);
+				settledIn.assign(nodeCount, 0);
+				targetIn.assign(nodeCount, 0);
+				search = 1;
+			}
+			open.clear();
+		}
+		double distance(int node) const
+		{
+			return reachedIn[node] == search ? distanceTo[node] : numeric_limits<double>::infinity();
+		}
+		void reach(int node, double d)
+		{
+			distanceTo[node] = d;
+			reachedIn[node] = search;
+		}
+		//the open list is a binary heap in a vector, so its storage is kept between searches too
+		void push(const QueueEntry& entry)
+		{
+			open.push_back(entry);
+			push_heap(open.begin(), open.end(), greater<QueueEntry>());
+		}
+		QueueEntry pop()
+		{
+			pop_heap(open.begin(), open.end(), greater<QueueEntry>());
+			QueueEntry entry = open.back();
+			open.pop_back();
+			return entry;
+		}
+		vector<double> distanceTo;
+		vector<unsigned int> reachedIn;
+		vector<unsigned int> settledIn;
+		vector<unsigned int> targetIn;
+		vector<QueueEntry> open;
+		unsigned int search;
+	};
+
+	//Dijkstra from one point until every point's node has been settled, writing the distances
+	//into that point's row of the matrix. Returns false if some point can't be reached.
+	bool fillRow(const StreetGraph& graph, const vector<int>& nodes, int row, DistanceMatrix& matrix)
+	{
+		static thread_local RowSearch side;
+		side.begin(graph.nodeCount());
+		unsigned int search = side.search;
+
+		//the distinct nodes still waiting to be settled
+		int targetsLeft = 0;
+		for (int i = 0; i < (int)nodes.size(); i++)
+		{
+			if (side.targetIn[nodes[i]] != search)
+			{
+				side.targetIn[nodes[i]] = search;
+				targetsLeft++;
+			}
+		}
+
+		side.reach(nodes[row], 0);
+		side.push(QueueEntry(0, nodes[row]));
+		while (!side.open.empty() && targetsLeft > 0)
+		{
+			QueueEntry current = side.pop();
+			if (side.settledIn[current.second] == search)
+				continue;
+			side.settledIn[current.second] = search;
+			if (side.targetIn[current.second] == search)
+				targetsLeft--;
+			for (SegmentRef seg : graph.segmentsFrom(current.second))
+			{
+				double d = current.first + seg.length();
+				if (d < side.distance(seg.endNode()))
+				{
+					side.reach(seg.endNode(), d);
+					side.push(QueueEntry(d, seg.endNode()));
+				}
+			}
+		}
+		if (targetsLeft > 0)
+			return false;
+		for (int col = 0; col < (int)nodes.size(); col++)
+			matrix.set(row, col, side.distance(nodes[col]));
+		return true;
+	}
+}
+
+DeliveryResult computeDistanceMatrix(const StreetMap& sm, const vector<GeoCoord>& points, DistanceMatrix& matrix)
+{
+	const StreetGraph& graph = getStreetGraph(sm);
+	vector<int> nodes(points.size());
+	for (int i = 0; i < (int)points.size(); i++)
+	{
+		nodes[i] = graph.findNode(points[i]);
+		if (nodes[i] == -1)
+			return BAD_COORD;
+	}
+	matrix.resize((int)points.size());
+
+	//the rows are independent, so share them out over the pool
+	atomic<bool> allReached(true);
+	ThreadPool::shared().parallelFor((int)points.size(), [&](int row) {
+		if (!fillRow(graph, nodes, row, matrix))
+			allReached = false;
+	});
+	return allReached ? DELIVERY_SUCCESS : NO_ROUTE;
+}
+
+DeliveryResult extendDistanceMatrix(const StreetMap& sm, const vector<GeoCoord>& points, int known,
+	DistanceMatrix& matrix)
+{
+	const StreetGraph& graph = getStreetGraph(sm);
+	vector<int> nodes(points.size());
+	for (int i = 0; i < (int)points.size(); i++)
+	{
+		nodes[i] = graph.findNode(points[i]);
+		if (nodes[i] == -1)
+			return BAD_COORD;
+	}
+	matrix.grow((int)points.size());
+
+	//search from each new point only, then copy its row into its column
+	int added = (int)points.size() - known;
+	atomic<bool> allReached(true);
+	ThreadPool::shared().parallelFor(added, [&](int i) {
+		if (!fillRow(graph, nodes, known + i, matrix))
+			allReached = false;
+	});
+	if (!allReached)
+		return NO_ROUTE;
+	for (int row = known; row < (int)points.size(); row++)
+		for (int col = 0; col < known; col++)
+			matrix.set(col, row, matrix.at(row, col));
+	return DELIVERY_SUCCESS;
+}
@@ -1,7 +1,7 @@
 #ifndef EXPANDABLEHASHMAP_H
 #define EXPANDABLEHASHMAP_H
 
-#include <vector>
+#include <utility>
 
 // ExpandableHashMap.h
 // Skeleton for the ExpandableHashMap class template.  You must implement the first six
@@ -16,6 +16,8 @@ public:
 	void reset();
 	int size() const;
 	void associate(const KeyType& key, const ValueType& value);
+	// make room for n associations up front so that adding them never rehashes
+	void reserve(int n);
 	// for a map that can't be modified, return a pointer to const ValueType
 	const ValueType* find(const KeyType& key) const;
 	// for a modifiable map, return a pointer to modifiable ValueType
@@ -27,17 +29,23 @@ public:
 	ExpandableHashMap(const ExpandableHashMap&) = delete;
 	ExpandableHashMap& operator=(const ExpandableHashMap&) = delete;
 private:
-	int m_buckets;
+	int m_buckets; //always a power of two, so a hash can be masked instead of divided
 	double m_load;
 	int m_size; //the # of associations in the hash map
 	struct Association
 	{
 		KeyType m_key;
 		ValueType m_value;
+		unsigned int m_hash; //kept so that rehashing and probing don't have to call hasher again
+		bool m_used;
 	};
 
-	std::vector<Association>** m_hashMap;
+	//open addressing: every association lives directly in this one array. A key that hashes to a
+	//taken slot goes in the next free one after it (linear probing), so a lookup walks a short
+	//run of neighbouring slots instead of chasing pointers to a separate vector per bucket.
+	Association* m_hashMap;
 
+	void rehash(int newBuckets);
 };
 template <typename KeyType, typename ValueType>
 ExpandableHashMap<KeyType, ValueType>::ExpandableHashMap(double maximumLoadFactor)
@@ -45,34 +53,33 @@ ExpandableHashMap<KeyType, ValueType>::ExpandableHashMap(double maximumLoadFacto
 	m_buckets = 8;
 	if (maximumLoadFactor <= 0)
 		m_load = 0.5;
+	else if (maximumLoadFactor > 0.9) //the array must never fill up, or probing would never end
+		m_load = 0.9;
 	else
 		m_load = maximumLoadFactor;
 	m_size = 0;
-	m_hashMap = new std::vector<Association> * [m_buckets];
+	m_hashMap = new Association[m_buckets];
 	for (int i = 0; i < m_buckets; i++)
 	{
-		m_hashMap[i] = nullptr;
+		m_hashMap[i].m_used = false;
 	}
 }
 template <typename KeyType, typename ValueType>
 ExpandableHashMap<KeyType, ValueType>::~ExpandableHashMap()
 {
-	for (int i = 0; i < m_buckets; i++) 
-	{
-		delete m_hashMap[i];
-	}
 	delete[] m_hashMap;
 }
 template <typename KeyType, typename ValueType>
 void ExpandableHashMap<KeyType, ValueType>::reset()
 {
+	delete[] m_hashMap;
+	m_buckets = 8;
+	m_size = 0;
+	m_hashMap = new Association[m_buckets];
 	for (int i = 0; i < m_buckets; i++)
 	{
-		delete m_hashMap[i];
+		m_hashMap[i].m_used = false;
 	}
-	delete m_hashMap;
-	m_buckets = 8;
-	m_hashMap = new std::vector<Association> * [m_buckets];
 }
 template <typename KeyType, typename ValueType>
 int ExpandableHashMap<KeyType, ValueType>::size() const
@@ -82,94 +89,82 @@ int ExpandableHashMap<KeyType, ValueType>::size() const
 template <typename KeyType, typename ValueType>
 void ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& value)
 {
-	ValueType* ptr = find(key);
-	//if the key already exists, update its value
-	if (ptr != nullptr)
-	{
-		*ptr = value;
-	}
-	else
-	{
-		unsigned int hasher(const KeyType& g);
-		unsigned int h = hasher(key);
-		unsigned int index = (h % m_buckets);
-
-		std::vector<Association>* vectorOfInterest = m_hashMap[index];
+	unsigned int hasher(const KeyType& g);
+	unsigned int h = hasher(key);
+	unsigned int mask = m_buckets - 1;
+	unsigned int index = h & mask;
 
-		//if there is no pointer to vector in the desired index slot of the hash map, create one.
-		//Either way, create a new Association and push back onto the vector
-		if (vectorOfInterest == nullptr)
+	//walk the run of taken slots starting at the key's home slot. If the key is in it, update
+	//its value; otherwise the first free slot after it is where the key goes
+	while (m_hashMap[index].m_used)
+	{
+		if (m_hashMap[index].m_hash == h && m_hashMap[index].m_key == key)
 		{
-			vectorOfInterest = new std::vector <Association>;
-			m_hashMap[index] = vectorOfInterest;
+			m_hashMap[index].m_value = value;
+			return;
 		}
-		Association newAssociation;
-		newAssociation.m_key = key;
-		newAssociation.m_value = value;
-		vectorOfInterest->push_back(newAssociation);
-		m_size++; 
-
-		//if the load of the hashmap exceeds the max load limit, rehash it 
-		double tempLoad = (double)size() / m_buckets;
-		if (tempLoad >= m_load)
-		{
-			m_buckets *= 2;
-			m_size = 0; 
-			std::vector<Association>** newHashMap = new std::vector<Association> * [m_buckets]; 
-			for (int i = 0; i < m_buckets; i++)
-			{
-				newHashMap[i] = nullptr;
-			}
-			for (int i = 0; i < m_buckets / 2; i++)
-			{
-				//create a new vector in the new hash map only if one existed in the previous one
-				if (m_hashMap[i] != nullptr)
-				{
-					for (int j = 0; j < (*m_hashMap[i]).size(); j++)
-					{
-						//rehash into a new slot in the new hash map
-						//create a pointer to a vector there if one doesn't already exist
-						unsigned int hasher(const KeyType& g);
-						unsigned int newIndex = hasher((*m_hashMap[i])[j].m_key) % m_buckets;
+		index = (index + 1) & mask;
+	}
+	m_hashMap[index].m_key = key;
+	m_hashMap[index].m_value = value;
+	m_hashMap[index].m_hash = h;
+	m_hashMap[index].m_used = true;
+	m_size++;
 
-						if (newHashMap[newIndex] == nullptr)
-						{
-							newHashMap[newIndex] = new std::vector<Association>;
-							//m_size++;
-						}
-						Association copyAssociation;
-						copyAssociation.m_key = (*m_hashMap[i])[j].m_key;
-						copyAssociation.m_value = (*m_hashMap[i])[j].m_value;
-						(*newHashMap[newIndex]).push_back(copyAssociation);
-						m_size++; 
-					}
-					delete m_hashMap[i];
-				}
-			}
-			//delete the old hash map and set the pointer equal to the new one
-			delete[] m_hashMap;
-			m_hashMap = newHashMap;
-		}
+	//if the load of the hashmap exceeds the max load limit, rehash it 
+	double tempLoad = (double)size() / m_buckets;
+	if (tempLoad >= m_load)
+		rehash(m_buckets * 2);
+}
+template <typename KeyType, typename ValueType>
+void ExpandableHashMap<KeyType, ValueType>::reserve(int n)
+{
+	int newBuckets = m_buckets;
+	while ((double)n / newBuckets >= m_load)
+		newBuckets *= 2;
+	if (newBuckets != m_buckets)
+		rehash(newBuckets);
+}
+template <typename KeyType, typename ValueType>
+void ExpandableHashMap<KeyType, ValueType>::rehash(int newBuckets)
+{
+	Association* newHashMap = new Association[newBuckets];
+	for (int i = 0; i < newBuckets; i++)
+	{
+		newHashMap[i].m_used = false;
+	}
+	//move every association into the first free slot from its home slot in the new array; the
+	//keys are all distinct, so there is no need to compare them
+	unsigned int mask = newBuckets - 1;
+	for (int i = 0; i < m_buckets; i++)
+	{
+		if (!m_hashMap[i].m_used)
+			continue;
+		unsigned int newIndex = m_hashMap[i].m_hash & mask;
+		while (newHashMap[newIndex].m_used)
+			newIndex = (newIndex + 1) & mask;
+		newHashMap[newIndex].m_key = std::move(m_hashMap[i].m_key);
+		newHashMap[newIndex].m_value = std::move(m_hashMap[i].m_value);
+		newHashMap[newIndex].m_hash = m_hashMap[i].m_hash;
+		newHashMap[newIndex].m_used = true;
 	}
+	//delete the old hash map and set the pointer equal to the new one
+	delete[] m_hashMap;
+	m_hashMap = newHashMap;
+	m_buckets = newBuckets;
 }
 template <typename KeyType, typename ValueType>
 const ValueType* ExpandableHashMap<KeyType, ValueType>::find(const KeyType& key) const
 {
-	//get the index in which the value type corresponding to the key would have been stored
+	//start at the slot the key hashes to; it is somewhere in the run of taken slots from there
 	unsigned int hasher(const KeyType& g);
-	unsigned int index = hasher(key) % m_buckets;
-	std::vector<Association>* vectorOfInterest = m_hashMap[index];
-	if (vectorOfInterest != nullptr)
+	unsigned int h = hasher(key);
+	unsigned int mask = m_buckets - 1;
+	for (unsigned int index = h & mask; m_hashMap[index].m_used; index = (index + 1) & mask)
 	{
-		for (int j = 0; j < vectorOfInterest->size(); j++)
-		{
-			if ((*vectorOfInterest)[j].m_key == key)
-			{
-				const ValueType* ptr = &((*vectorOfInterest)[j].m_value);
-				return ptr;
-			}
-		}
+		if (m_hashMap[index].m_hash == h && m_hashMap[index].m_key == key)
+			return &m_hashMap[index].m_value;
 	}
 	return nullptr;
 }
-#endif
\ No newline at end of file
+#endif
@@ -1,9 +1,9 @@
 #include "provided.h"
+#include "support.h"
+#include "ThreadPool.h"
 #include <list>
-#include <queue>
-#include <unordered_map>
-#include "ExpandableHashMap.h"
-#include <map>
+#include <vector>
+#include <algorithm>
 using namespace std;
 
 class PointToPointRouterImpl
@@ -16,13 +16,137 @@ public:
         const GeoCoord& end,
         list<StreetSegment>& route,
         double& totalDistanceTravelled) const;
+	DeliveryResult generatePointToPointRoute(
+		const GeoCoord& start,
+		const GeoCoord& end,
+		Route& route,
+		double& totalDistanceTravelled,
+		RouteStats* stats) const;
+	void setSearchMode(RouteSearchMode mode) { searchMode = mode; }
+	void setHierarchy(const ContractionHierarchy* ch) { hierarchy = ch; }
+	DeliveryResult generateMultiLegRoute(
+		const vector<GeoCoord>& waypoints,
+		Route& route,
+		vector<LegResult>& legs,
+		double& totalDistanceTravelled,
+		RouteStats* stats) const;
+	void setCache(RouteCache* rc) { cache = rc; }
+	void setObjective(RouteObjective o, double departure) { objective = o; departureTime = departure; }
 private: 
 	const StreetMap* StreetMapPtr;
+	RouteSearchMode searchMode;
+	const ContractionHierarchy* hierarchy;
+	RouteCache* cache;
+	RouteObjective objective;
+	double departureTime;
+
+	//an entry in a search's open list; f = distance travelled so far (g) + estimate of what's left
+	//(or for ROUTE_FASTEST, time taken so far + estimate of the time left)
+	struct OpenEntry
+	{
+		double f;
+		double g;
+		int node;
+	};
+	struct LaterEntry
+	{
+		bool operator()(const OpenEntry& a, const OpenEntry& b) const { return a.f > b.f; }
+	};
+
+	//one direction of a search: how far each node is from where it started, and the node and
+	//edge it was reached through. A side is kept and reused for every search on its thread, so
+	//instead of clearing its arrays each search has a new number, and a node's entries only
+	//count if they were written by the current search.
+	struct SearchSide
+	{
+		SearchSide() : search(0) {}
+		void begin(int nodeCount, int from, double estimate)
+		{
+			if ((int)visitedIn.size() != nodeCount || ++search == 0)
+			{
+				//a different map, or the search numbers ran out: start the arrays afresh
+				distanceTo.assign(nodeCount, 0);
+				previousNode.assign(nodeCount, -1);
+				previousEdge.assign(nodeCount, -1);
+				visitedIn.assign(nodeCount, 0);
+				open.reserve(1024);
+				search = 1;
+			}
+			open.clear();
+			reach(from, 0, -1, -1);
+			push(OpenEntry{ estimate, 0, from });
+		}
+		bool reached(int node) const { return visitedIn[node] == search; }
+		void reach(int node, double g, int fromNode, int fromEdge)
+		{
+			distanceTo[node] = g;
+			previousNode[node] = fromNode;
+			previousEdge[node] = fromEdge;
+			visitedIn[node] = search;
+		}
+		//the open list is a binary heap in a vector, so its storage is kept between searches too
+		void push(const OpenEntry& entry)
+		{
+			open.push_back(entry);
+			push_heap(open.begin(), open.end(), LaterEntry());
+		}
+		OpenEntry pop()
+		{
+			pop_heap(open.begin(), open.end(), LaterEntry());
+			OpenEntry entry = open.back();
+			open.pop_back();
+			return entry;
+		}
+		vector<double> distanceTo;
+		vector<int> previousNode;
+		vector<int> previousEdge;
+		vector<unsigned int> visitedIn;
+		unsigned int search;
+		vector<OpenEntry> open;
+	};
+
+	//the searches add the nodes they expand and the edges they relax to counts (when stats are
+	//being collected). searchForward and searchFastest carry on from wherever fromStart began.
+	bool searchForward(const StreetGraph& graph, int end, SearchSide& fromStart, RouteStats& counts) const;
+	bool searchFastest(const StreetGraph& graph, const TravelTimes& times, int end, double departure,
+		SearchSide& fromStart, RouteStats& counts) const;
+	bool searchBothWays(const StreetGraph& graph, int start, int end,
+		SearchSide& fromStart, SearchSide& fromEnd, int& meetingPoint, RouteStats& counts) const;
+	void expandOne(const StreetGraph& graph, SearchSide& side, int target,
+		const SearchSide& other, double& bestTotal, int& meetingPoint, RouteStats& counts) const;
+	//set route to the route between two nodes setting off at departure, and distance to its
+	//length, adding what it took to counts
+	DeliveryResult routeBetween(const StreetGraph& graph, int startNode, int endNode, double departure,
+		Route& route, double& distance, RouteStats& counts) const;
+	//the edges of a shortest (or fastest) route from start to end, in travel order, using the
+	//search mode
+	bool findRoute(const StreetGraph& graph, int start, int end, double departure, vector<int>& edges,
+		RouteStats& counts) const;
+	//every segment is stored once from each end: the edge from `from` to `to` that is edge the
+	//other way round
+	static int reverseOf(const StreetGraph& graph, int edge, int from, int to)
+	{
+		int fallback = -1;
+		for (SegmentRef seg : graph.segmentsFrom(from))
+		{
+			if (seg.endNode() != to)
+				continue;
+			if (seg.street() == graph.edgeStreet(edge) && seg.length() == graph.edgeLength(edge))
+				return seg.edge();
+			fallback = seg.edge();
+		}
+		return fallback;
+	}
 };
 
 PointToPointRouterImpl::PointToPointRouterImpl(const StreetMap* sm)
 {
 	StreetMapPtr = sm;
+	searchMode = ROUTE_ASTAR;
+	hierarchy = nullptr;
+	cache = nullptr;
+	objective = ROUTE_SHORTEST;
+	departureTime = 0;
 }
 
 PointToPointRouterImpl::~PointToPointRouterImpl()
@@ -35,80 +159,325 @@ DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
         list<StreetSegment>& route,
         double& totalDistanceTravelled) const
 {
+	//find the route as edges, then copy it out segment by segment
+	static thread_local Route found;
+	route.clear();
+	DeliveryResult result = generatePointToPointRoute(start, end, found, totalDistanceTravelled, nullptr);
+	found.appendTo(route);
+	return result;
+}
+
+DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
+	const GeoCoord& start,
+	const GeoCoord& end,
+	Route& route,
+	double& totalDistanceTravelled,
+	RouteStats* stats) const
+{
+	ScopedTimer timer(stats != nullptr ? &stats->milliseconds : nullptr);
 	route.clear();
-	vector<StreetSegment> segs; 
-	if (StreetMapPtr->getSegmentsThatStartWith(start, segs) == false || StreetMapPtr->getSegmentsThatStartWith(end, segs) == false)
+	const StreetGraph& graph = getStreetGraph(*StreetMapPtr);
+	RouteStats counts;
+	long long* probes = (statsEnabled ? &counts.hashProbes : nullptr);
+	int startNode = graph.findNode(start, probes);
+	int endNode = graph.findNode(end, probes);
+	DeliveryResult result = BAD_COORD;
+	if (startNode != -1 && endNode != -1)
 	{
-		cerr << "BAD_COORD returned" << endl;
-		return BAD_COORD;
+		double distance;
+		result = routeBetween(graph, startNode, endNode, departureTime, route, distance, counts);
+		totalDistanceTravelled += distance;
 	}
+	if (statsEnabled && stats != nullptr)
+		stats->add(counts);
+	return result;
+}
+
+DeliveryResult PointToPointRouterImpl::generateMultiLegRoute(
+	const vector<GeoCoord>& waypoints,
+	Route& route,
+	vector<LegResult>& legs,
+	double& totalDistanceTravelled,
+	RouteStats* stats) const
+{
+	ScopedTimer timer(stats != nullptr ? &stats->milliseconds : nullptr);
+	route.clear();
+	legs.clear();
+	totalDistanceTravelled = 0;
 
-	if (start == end)
+	//check every waypoint once, up front
+	const StreetGraph& graph = getStreetGraph(*StreetMapPtr);
+	RouteStats counts;
+	vector<int> nodes(waypoints.size());
+	for (int i = 0; i < waypoints.size(); i++)
+	{
+		nodes[i] = graph.findNode(waypoints[i], statsEnabled ? &counts.hashProbes : nullptr);
+		if (nodes[i] == -1)
+		{
+			if (statsEnabled && stats != nullptr)
+				stats->add(counts);
+			return BAD_COORD;
+		}
+	}
+
+	//shortest legs don't depend on each other, so route them all at once, each into its own
+	//route, then join them up in order. The fastest route for a leg depends on when it sets off,
+	//so those have to wait for the leg before.
+	const TravelTimes& times = getTravelTimes(*StreetMapPtr);
+	int legCount = max(0, (int)waypoints.size() - 1);
+	legs.assign(legCount, LegResult());
+	vector<Route> legRoutes(legCount);
+	if (objective == ROUTE_FASTEST)
+	{
+		double clock = departureTime;
+		for (int i = 0; i < legCount; i++)
+		{
+			legs[i].result = routeBetween(graph, nodes[i], nodes[i + 1], clock, legRoutes[i], legs[i].distance, counts);
+			clock += times.hoursFor(legRoutes[i], clock);
+		}
+	}
+	else
+	{
+		//each leg counts into its own stats, added up once they are all done
+		vector<RouteStats> legCounts(statsEnabled ? legCount : 0);
+		ThreadPool::shared().parallelFor(legCount, [&](int i) {
+			RouteStats unused;
+			legs[i].result = routeBetween(graph, nodes[i], nodes[i + 1], departureTime, legRoutes[i], legs[i].distance,
+				statsEnabled ? legCounts[i] : unused);
+		});
+		for (int i = 0; i < (int)legCounts.size(); i++)
+			counts.add(legCounts[i]);
+	}
+	if (statsEnabled && stats != nullptr)
+		stats->add(counts);
+
+	//a route can't have a gap in it, so it stops short at the first leg that failed
+	if (!waypoints.empty())
+		route.begin(&graph, nodes[0]);
+	DeliveryResult result = DELIVERY_SUCCESS;
+	double clock = departureTime;
+	for (int i = 0; i < legCount; i++)
+	{
+		legs[i].hours = times.hoursFor(legRoutes[i], clock);
+		clock += legs[i].hours;
+		if (result == DELIVERY_SUCCESS)
+		{
+			result = legs[i].result;
+			if (result == DELIVERY_SUCCESS)
+				route.append(legRoutes[i]);
+		}
+		totalDistanceTravelled += legs[i].distance;
+	}
+	return result;
+}
+
+DeliveryResult PointToPointRouterImpl::routeBetween(const StreetGraph& graph, int startNode, int endNode,
+	double departure, Route& route, double& distance, RouteStats& counts) const
+{
+	route.begin(&graph, startNode);
+	distance = 0;
+	if (statsEnabled)
+		counts.routes++;
+	if (startNode == endNode)
 		return DELIVERY_SUCCESS; //eg. if all deliveries are at the depot itself
 
-	queue<GeoCoord> GQ;
-	ExpandableHashMap<GeoCoord, GeoCoord> locationOfPreviousWayPoint;
-	GQ.push(start);
-	bool pathFound = false;
+	//reused by every query on this thread. The cache only holds shortest routes.
+	static thread_local vector<int> edges;
+	RouteCache* shortestCache = (objective == ROUTE_SHORTEST ? cache : nullptr);
+	if (shortestCache != nullptr && shortestCache->find(graph, startNode, endNode, edges, distance))
+	{
+		if (statsEnabled)
+			counts.cacheHits++;
+	}
+	else
+	{
+		if (!findRoute(graph, startNode, endNode, departure, edges, counts))
+			return NO_ROUTE;
+		for (int i = 0; i < edges.size(); i++)
+			distance += graph.edgeLength(edges[i]);
+		if (shortestCache != nullptr)
+			shortestCache->store(graph, startNode, endNode, edges, distance);
+	}
+
+	for (int i = 0; i < edges.size(); i++)
+		route.append(edges[i]);
+	return DELIVERY_SUCCESS;
+}
 
-	while (!GQ.empty())
+bool PointToPointRouterImpl::findRoute(const StreetGraph& graph, int startNode, int endNode, double departure,
+	vector<int>& edges, RouteStats& counts) const
+{
+	edges.clear();
+	static thread_local SearchSide fromStart, fromEnd;
+	if (objective == ROUTE_FASTEST)
+	{
+		const TravelTimes& times = getTravelTimes(*StreetMapPtr);
+		fromStart.begin(graph.nodeCount(), startNode, graph.crowMiles(startNode, endNode) / times.fastestMph());
+		if (!searchFastest(graph, times, endNode, departure, fromStart, counts))
+			return false;
+		for (int node = endNode; node != startNode; node = fromStart.previousNode[node])
+			edges.push_back(fromStart.previousEdge[node]);
+		reverse(edges.begin(), edges.end());
+		return true;
+	}
+	if (searchMode == ROUTE_CONTRACTION_HIERARCHY && hierarchy != nullptr && hierarchy->ready())
+	{
+		static thread_local vector<int> nodes;
+		double distance;
+		return hierarchy->findRoute(startNode, endNode, nodes, edges, distance, statsEnabled ? &counts : nullptr);
+	}
+
+	//each thread keeps its own search arrays (fromStart and fromEnd) from one query to the
+	//next, so once they have grown to fit the map, searching allocates nothing
+	double estimate = graph.crowMiles(startNode, endNode);
+	fromStart.begin(graph.nodeCount(), startNode, estimate);
+	int meetingPoint = endNode;
+	if (searchMode == ROUTE_BIDIRECTIONAL)
+	{
+		fromEnd.begin(graph.nodeCount(), endNode, estimate);
+		if (!searchBothWays(graph, startNode, endNode, fromStart, fromEnd, meetingPoint, counts))
+			return false;
+	}
+	else if (!searchForward(graph, endNode, fromStart, counts))
+		return false;
+
+	//walk back from the meeting point (or the end) to the start, then forward to the end
+	for (int node = meetingPoint; node != startNode; node = fromStart.previousNode[node])
+		edges.push_back(fromStart.previousEdge[node]);
+	reverse(edges.begin(), edges.end());
+	if (searchMode == ROUTE_BIDIRECTIONAL)
+	{
+		//fromEnd reached each node by an edge pointing away from the end, so drive each of those
+		//segments the other way
+		for (int node = meetingPoint; node != endNode; node = fromEnd.previousNode[node])
+			edges.push_back(reverseOf(graph, fromEnd.previousEdge[node], node, fromEnd.previousNode[node]));
+	}
+	return true;
+}
+
+//A* search from start to end. Street segments are weighted by their length, and the straight
+//line distance to the end is the heuristic: it never overestimates, so the first time end
+//is taken off the open list we have a shortest route.
+bool PointToPointRouterImpl::searchForward(const StreetGraph& graph, int end, SearchSide& fromStart,
+	RouteStats& counts) const
+{
+	while (!fromStart.open.empty())
 	{
-		GeoCoord current = GQ.front();
-		GQ.pop();
+		OpenEntry current = fromStart.pop();
 
-		if (current == end)
+		//skip entries left behind when a shorter way to their node was found
+		if (current.g > fromStart.distanceTo[current.node])
+			continue;
+		if (current.node == end)
+			return true;
+
+		if (statsEnabled)
+			counts.nodesExpanded++;
+		for (SegmentRef seg : graph.segmentsFrom(current.node))
 		{
-			pathFound = true;
-			break;
+			if (statsEnabled)
+				counts.edgesRelaxed++;
+			int next = seg.endNode();
+			double g = current.g + seg.length();
+			if (!fromStart.reached(next) || g < fromStart.distanceTo[next])
+			{
+				fromStart.reach(next, g, current.node, seg.edge());
+				fromStart.push(OpenEntry{ g + graph.crowMiles(next, end), g, next });
+			}
 		}
-		//find all segments that start with the current location and
-		//(1) push them onto the queue of GeoCoords for later evaluation,
-		//(2) make associations in the hash map
-		if (StreetMapPtr->getSegmentsThatStartWith(current, segs))
+	}
+	return false;
+}
+
+//A* on travel times: g is how long it has taken to reach a node, and each segment takes as long
+//as its speed at the time it is reached says. The heuristic is the straight line distance at
+//the map's fastest speed, which never overestimates. Only the earliest arrival at each node is
+//kept, which is exact as long as arriving later never means getting somewhere sooner; with
+//speeds that change on the hour that can only fail for a segment entered just before a
+//change, so routes are at worst a little slow across an hour boundary.
+bool PointToPointRouterImpl::searchFastest(const StreetGraph& graph, const TravelTimes& times, int end,
+	double departure, SearchSide& fromStart, RouteStats& counts) const
+{
+	double fastest = times.fastestMph();
+	while (!fromStart.open.empty())
+	{
+		OpenEntry current = fromStart.pop();
+		if (current.g > fromStart.distanceTo[current.node])
+			continue;
+		if (current.node == end)
+			return true;
+
+		if (statsEnabled)
+			counts.nodesExpanded++;
+		for (SegmentRef seg : graph.segmentsFrom(current.node))
 		{
-			for (int i = 0; i < segs.size(); i++)
+			if (statsEnabled)
+				counts.edgesRelaxed++;
+			int next = seg.endNode();
+			double g = current.g + times.hoursFor(seg.edge(), departure + current.g);
+			if (!fromStart.reached(next) || g < fromStart.distanceTo[next])
 			{
-				if (locationOfPreviousWayPoint.find(segs[i].end) == nullptr)
-				{
-					GQ.push(segs[i].end);
-					locationOfPreviousWayPoint.associate(segs[i].end, current);
-				}
+				fromStart.reach(next, g, current.node, seg.edge());
+				fromStart.push(OpenEntry{ g + graph.crowMiles(next, end) / fastest, g, next });
 			}
 		}
-		while (!segs.empty())
-			segs.pop_back();
 	}
+	return false;
+}
 
-	if (!pathFound)
+//Bidirectional A*: one search grows from start towards end and another from end towards start
+//(every segment is stored in both directions, so the backward search can walk the map as is).
+//Every time a node is reached by one search that the other has also reached, that's a
+//candidate route. Once either open list can't produce anything shorter than the best candidate,
+//that candidate is a shortest route.
+bool PointToPointRouterImpl::searchBothWays(const StreetGraph& graph, int start, int end,
+	SearchSide& fromStart, SearchSide& fromEnd, int& meetingPoint, RouteStats& counts) const
+{
+	double bestTotal = -1; //the length of the shortest route found so far, -1 if none yet
+	//an empty open list means that side has reached everything it can, so the best candidate
+	//(if there is one) can't be beaten either
+	while (!fromStart.open.empty() && !fromEnd.open.empty())
 	{
-		cerr << "NO_ROUTE returned" << endl;
-		return NO_ROUTE; 
+		if (bestTotal >= 0 && (fromStart.open.front().f >= bestTotal || fromEnd.open.front().f >= bestTotal))
+			return true;
+
+		//grow whichever search has the smaller frontier
+		if (fromStart.open.size() <= fromEnd.open.size())
+			expandOne(graph, fromStart, end, fromEnd, bestTotal, meetingPoint, counts);
+		else
+			expandOne(graph, fromEnd, start, fromStart, bestTotal, meetingPoint, counts);
 	}
-	else
+	return bestTotal >= 0;
+}
+
+//take the best entry off one side's open list and relax its edges, recording any improved
+//meeting point with the other side
+void PointToPointRouterImpl::expandOne(const StreetGraph& graph, SearchSide& side, int target,
+	const SearchSide& other, double& bestTotal, int& meetingPoint, RouteStats& counts) const
+{
+	OpenEntry current = side.pop();
+	if (current.g > side.distanceTo[current.node])
+		return;
+
+	if (statsEnabled)
+		counts.nodesExpanded++;
+	for (SegmentRef seg : graph.segmentsFrom(current.node))
 	{
-		//reconstruct the whole route backwards using the associations from the hash map
-		GeoCoord myEnd = end;
-		while (myEnd!=start)
+		if (statsEnabled)
+			counts.edgesRelaxed++;
+		int next = seg.endNode();
+		double g = current.g + seg.length();
+		if (side.reached(next) && g >= side.distanceTo[next])
+			continue;
+		side.reach(next, g, current.node, seg.edge());
+		side.push(OpenEntry{ g + graph.crowMiles(next, target), g, next });
+
+		if (other.reached(next) && (bestTotal < 0 || g + other.distanceTo[next] < bestTotal))
 		{
-			GeoCoord startCoord = myEnd;
-			GeoCoord endCoord = *(locationOfPreviousWayPoint.find(startCoord));
-			vector<StreetSegment> vec;
-			StreetMapPtr->getSegmentsThatStartWith(startCoord, vec);
-			for (int i = 0; i < vec.size(); i++)
-			{
-				if (vec[i].end == endCoord)
-				{
-					StreetSegment temp(endCoord, startCoord, vec[i].name);
-					route.push_front(temp);
-					break;
-				}
-			}
-			totalDistanceTravelled += distanceEarthMiles(endCoord, startCoord); 
-			myEnd = endCoord;
+			bestTotal = g + other.distanceTo[next];
+			meetingPoint = next;
 		}
 	}
-	return DELIVERY_SUCCESS;
-	
 }
 
 //******************** PointToPointRouter functions ***************************
@@ -134,3 +503,46 @@ DeliveryResult PointToPointRouter::generatePointToPointRoute(
 {
     return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled);
 }
+
+void setRouteSearchMode(PointToPointRouter& router, RouteSearchMode mode)
+{
+    implOf<PointToPointRouterImpl>(router)->setSearchMode(mode);
+}
+
+void useContractionHierarchy(PointToPointRouter& router, const ContractionHierarchy* hierarchy)
+{
+    implOf<PointToPointRouterImpl>(router)->setHierarchy(hierarchy);
+    implOf<PointToPointRouterImpl>(router)->setSearchMode(ROUTE_CONTRACTION_HIERARCHY);
+}
+
+void useRouteCache(PointToPointRouter& router, RouteCache* cache)
+{
+    implOf<PointToPointRouterImpl>(router)->setCache(cache);
+}
+
+void setRouteObjective(PointToPointRouter& router, RouteObjective objective, double departureTime)
+{
+    implOf<PointToPointRouterImpl>(router)->setObjective(objective, departureTime);
+}
+
+DeliveryResult generatePointToPointRoute(const PointToPointRouter& router, const GeoCoord& start,
+	const GeoCoord& end, Route& route, double& totalDistanceTravelled, RouteStats* stats)
+{
+    return implOf<PointToPointRouterImpl>(router)->generatePointToPointRoute(start, end, route, totalDistanceTravelled, stats);
+}
+
+DeliveryResult generateMultiLegRoute(const PointToPointRouter& router, const vector<GeoCoord>& waypoints,
+	Route& route, vector<LegResult>& legs, double& totalDistanceTravelled, RouteStats* stats)
+{
+    return implOf<PointToPointRouterImpl>(router)->generateMultiLegRoute(waypoints, route, legs, totalDistanceTravelled, stats);
+}
+
+DeliveryResult generateMultiLegRoute(const PointToPointRouter& router, const vector<GeoCoord>& waypoints,
+	list<StreetSegment>& route, vector<LegResult>& legs, double& totalDistanceTravelled, RouteStats* stats)
+{
+    Route found;
+    DeliveryResult result = generateMultiLegRoute(router, waypoints, found, legs, totalDistanceTravelled, stats);
+    route.clear();
+    found.appendTo(route);
+    return result;
+}
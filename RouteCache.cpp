@@ -0,0 +1,159 @@
+#include "provided.h"
+#include "support.h"
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+using namespace std;
+
+class RouteCacheImpl
+{
+public:
+	RouteCacheImpl(size_t maxBytes);
+	~RouteCacheImpl();
+	bool find(const StreetGraph& graph, int start, int end, vector<int>& edges, double& distance);
+	void store(const StreetGraph& graph, int start, int end, const vector<int>& edges, double distance);
+	void clear();
+	RouteCacheStats stats() const;
+private:
+	struct Entry
+	{
+		uint64_t key;
+		vector<int> edges;
+		double distance;
+	};
+
+	mutable mutex lock;           //guards everything below
+	size_t maxBytes;
+	uint64_t graphVersion;        //the version of the graph the routes were found in
+	list<Entry> entries;          //most recently used first
+	//ExpandableHashMap can't remove anything, which an LRU has to do all the time
+	unordered_map<uint64_t, list<Entry>::iterator> index;
+	RouteCacheStats counters;
+
+	static uint64_t keyOf(int start, int end) { return ((uint64_t)(uint32_t)start << 32) | (uint32_t)end; }
+	//roughly what an entry costs, counting its list node and its place in the index
+	static size_t sizeOf(const Entry& e) { return sizeof(Entry) + 64 + e.edges.size() * sizeof(int); }
+	void forgetStaleRoutes(const StreetGraph& graph);
+	void dropAll();
+};
+
+RouteCacheImpl::RouteCacheImpl(size_t maxBytes)
+	: maxBytes(maxBytes), graphVersion(0)
+{
+	counters = RouteCacheStats();
+}
+
+RouteCacheImpl::~RouteCacheImpl()
+{
+}
+
+bool RouteCacheImpl::find(const StreetGraph& graph, int start, int end, vector<int>& edges, double& distance)
+{
+	lock_guard<mutex> guard(lock);
+	forgetStaleRoutes(graph);
+	auto it = index.find(keyOf(start, end));
+	if (it == index.end())
+	{
+		counters.misses++;
+		return false;
+	}
+	counters.hits++;
+	entries.splice(entries.begin(), entries, it->second);
+	edges = it->second->edges;
+	distance = it->second->distance;
+	return true;
+}
+
+void RouteCacheImpl::store(const StreetGraph& graph, int start, int end, const vector<int>& edges, double distance)
+{
+	lock_guard<mutex> guard(lock);
+	forgetStaleRoutes(graph);
+	uint64_t key = keyOf(start, end);
+	if (index.find(key) != index.end())
+		return; //another thread got there first
+	Entry entry{ key, edges, distance };
+	size_t size = sizeOf(entry);
+	if (size > maxBytes)
+		return;
+
+	//make room by dropping the least recently used routes
+	while (counters.bytes + size > maxBytes)
+	{
+		counters.bytes -= sizeOf(entries.back());
+		index.erase(entries.back().key);
+		entries.pop_back();
+		counters.evictions++;
+	}
+	entries.push_front(entry);
+	index[key] = entries.begin();
+	counters.bytes += size;
+}
+
+void RouteCacheImpl::clear()
+{
+	lock_guard<mutex> guard(lock);
+	dropAll();
+}
+
+RouteCacheStats RouteCacheImpl::stats() const
+{
+	lock_guard<mutex> guard(lock);
+	RouteCacheStats s = counters;
+	s.routes = (int)entries.size();
+	return s;
+}
+
+//routes found in an older version of the graph (before the map was reloaded) may not exist in
+//this one, or its node IDs may mean other places entirely
+void RouteCacheImpl::forgetStaleRoutes(const StreetGraph& graph)
+{
+	if (graph.version() == graphVersion)
+		return;
+	if (!entries.empty())
+		counters.invalidations++;
+	dropAll();
+	graphVersion = graph.version();
+}
+
+void RouteCacheImpl::dropAll()
+{
+	entries.clear();
+	index.clear();
+	counters.bytes = 0;
+}
+
+//******************** RouteCache functions ***********************************
+
+// These functions simply delegate to RouteCacheImpl's functions.
+
+RouteCache::RouteCache(size_t maxBytes)
+{
+	m_impl = new RouteCacheImpl(maxBytes);
+}
+
+RouteCache::~RouteCache()
+{
+	delete m_impl;
+}
+
+bool RouteCache::find(const StreetGraph& graph, int start, int end, vector<int>& edges, double& distance) const
+{
+	return m_impl->find(graph, start, end, edges, distance);
+}
+
+void RouteCache::store(const StreetGraph& graph, int start, int end, const vector<int>& edges, double distance)
+{
+	m_impl->store(graph, start, end, edges, distance);
+}
+
+void RouteCache::clear()
+{
+	m_impl->clear();
+}
+
+RouteCacheStats RouteCache::stats() const
+{
+	return m_impl->stats();
+}
@@ -0,0 +1,261 @@
+#include "provided.h"
+#include "SpatialIndex.h"
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+using namespace std;
+
+namespace
+{
+	//aim for about this many nodes per cell: fewer wastes memory on empty cells, more means
+	//comparing against more nodes per cell visited
+	const double nodesPerCell = 2;
+
+	double milesBetween(double lat1, double lon1, double lat2, double lon2)
+	{
+		GeoCoord a, b;
+		a.latitude = lat1;
+		a.longitude = lon1;
+		b.latitude = lat2;
+		b.longitude = lon2;
+		return distanceEarthMiles(a, b);
+	}
+}
+
+SpatialIndex::SpatialIndex()
+{
+	clear();
+}
+
+void SpatialIndex::clear()
+{
+	m_graph = nullptr;
+	m_xScale = 1;
+	m_minX = m_minY = 0;
+	m_cellSize = 1;
+	m_columns = m_rows = 0;
+	m_nodeStart.assign(1, 0);
+	m_nodes.clear();
+	m_segmentStart.assign(1, 0);
+	m_segments.clear();
+	m_segmentEdge.clear();
+	m_segmentFrom.clear();
+}
+
+void SpatialIndex::build(const StreetGraph& graph)
+{
+	clear();
+	m_graph = &graph;
+	int n = graph.nodeCount();
+	if (n == 0)
+		return;
+
+	double minLat = graph.latitudeOf(0), maxLat = minLat;
+	double minLon = graph.longitudeOf(0), maxLon = minLon;
+	for (int v = 1; v < n; v++)
+	{
+		minLat = min(minLat, graph.latitudeOf(v));
+		maxLat = max(maxLat, graph.latitudeOf(v));
+		minLon = min(minLon, graph.longitudeOf(v));
+		maxLon = max(maxLon, graph.longitudeOf(v));
+	}
+	const double toRadians = 4 * atan(1.0) / 180;
+	m_xScale = max(cos((minLat + maxLat) / 2 * toRadians), 0.01);
+	m_minX = xOf(minLon);
+	m_minY = minLat;
+	double width = xOf(maxLon) - m_minX, height = maxLat - minLat;
+
+	//square cells, as many as it takes to hold about nodesPerCell nodes each if the nodes were
+	//spread evenly (but no thinner than a row of them, should the map be a single long street)
+	double cells = max(1.0, n / nodesPerCell);
+	m_cellSize = max(sqrt(width * height / cells), max(width, height) / cells);
+	if (m_cellSize <= 0)
+		m_cellSize = 1e-3;
+	m_columns = (int)(width / m_cellSize) + 1;
+	m_rows = (int)(height / m_cellSize) + 1;
+	int cellCount = m_columns * m_rows;
+
+	vector<pair<int, int>> cellItems;
+	cellItems.reserve(n);
+	for (int v = 0; v < n; v++)
+		cellItems.push_back(make_pair(rowOf(graph.latitudeOf(v)) * m_columns + columnOf(xOf(graph.longitudeOf(v))), v));
+	fillCells(m_nodeStart, m_nodes, cellCount, cellItems);
+
+	//each segment is stored in both directions; index it once, as the edge leaving its lower
+	//numbered end, in every cell its bounding box touches
+	cellItems.clear();
+	for (int from = 0; from < n; from++)
+	{
+		for (int e = graph.firstEdge(from); e < graph.firstEdge(from + 1); e++)
+		{
+			int to = graph.edgeTarget(e);
+			if (to <= from)
+				continue;
+			int s = (int)m_segmentEdge.size();
+			m_segmentEdge.push_back(e);
+			m_segmentFrom.push_back(from);
+			double x1 = xOf(graph.longitudeOf(from)), x2 = xOf(graph.longitudeOf(to));
+			double y1 = graph.latitudeOf(from), y2 = graph.latitudeOf(to);
+			int c1 = columnOf(min(x1, x2)), c2 = columnOf(max(x1, x2));
+			int r1 = rowOf(min(y1, y2)), r2 = rowOf(max(y1, y2));
+			for (int r = r1; r <= r2; r++)
+				for (int c = c1; c <= c2; c++)
+					cellItems.push_back(make_pair(r * m_columns + c, s));
+		}
+	}
+	fillCells(m_segmentStart, m_segments, cellCount, cellItems);
+}
+
+//lay cellItems (cell, item) out cell by cell, the way the graph lays out its edges
+void SpatialIndex::fillCells(vector<int>& start, vector<int>& items, int cellCount,
+	const vector<pair<int, int>>& cellItems)
+{
+	start.assign(cellCount + 1, 0);
+	for (int i = 0; i < (int)cellItems.size(); i++)
+		start[cellItems[i].first + 1]++;
+	for (int c = 0; c < cellCount; c++)
+		start[c + 1] += start[c];
+	items.resize(cellItems.size());
+	vector<int> next(start.begin(), start.end() - 1);
+	for (int i = 0; i < (int)cellItems.size(); i++)
+		items[next[cellItems[i].first]++] = cellItems[i].second;
+}
+
+int SpatialIndex::columnOf(double x) const
+{
+	int c = (int)floor((x - m_minX) / m_cellSize);
+	return min(max(c, 0), m_columns - 1);
+}
+
+int SpatialIndex::rowOf(double y) const
+{
+	int r = (int)floor((y - m_minY) / m_cellSize);
+	return min(max(r, 0), m_rows - 1);
+}
+
+//how far (x, y) is from the grid: from the cell at (column, row), the nearest one to it
+double SpatialIndex::distanceOutside(double x, double y, int column, int row) const
+{
+	double cellX = m_minX + column * m_cellSize, cellY = m_minY + row * m_cellSize;
+	return hypot(max(max(cellX - x, x - (cellX + m_cellSize)), 0.0),
+		max(max(cellY - y, y - (cellY + m_cellSize)), 0.0));
+}
+
+template<typename Visit>
+bool SpatialIndex::visitRing(int column, int row, int r, Visit visit) const
+{
+	int left = column - r, right = column + r, bottom = row - r, top = row + r;
+	if (left < 0 && right >= m_columns && bottom < 0 && top >= m_rows)
+		return false;
+	if (r == 0)
+	{
+		visit(row * m_columns + column);
+		return true;
+	}
+	int firstColumn = max(left, 0), lastColumn = min(right, m_columns - 1);
+	if (bottom >= 0)
+		for (int c = firstColumn; c <= lastColumn; c++)
+			visit(bottom * m_columns + c);
+	if (top < m_rows)
+		for (int c = firstColumn; c <= lastColumn; c++)
+			visit(top * m_columns + c);
+	int firstRow = max(bottom + 1, 0), lastRow = min(top - 1, m_rows - 1);
+	if (left >= 0)
+		for (int r2 = firstRow; r2 <= lastRow; r2++)
+			visit(r2 * m_columns + left);
+	if (right < m_columns)
+		for (int r2 = firstRow; r2 <= lastRow; r2++)
+			visit(r2 * m_columns + right);
+	return true;
+}
+
+int SpatialIndex::nearestNode(double latitude, double longitude) const
+{
+	if (m_nodes.empty())
+		return -1;
+	const StreetGraph& graph = *m_graph;
+	double x = xOf(longitude), y = latitude;
+	//a coordinate off the edge of the grid starts from the nearest cell on it
+	int column = columnOf(x), row = rowOf(y);
+	double outside = distanceOutside(x, y, column, row);
+
+	int best = -1;
+	double bestSquared = numeric_limits<double>::infinity();
+	for (int r = 0; ; r++)
+	{
+		//everything in ring r is at least r - 1 whole cells from the coordinate, and nothing is
+		//nearer to it than the grid itself
+		double reach = max(outside, (r - 1) * m_cellSize);
+		if (best != -1 && reach * reach >= bestSquared)
+			break;
+		bool inGrid = visitRing(column, row, r, [&](int cell) {
+			for (int i = m_nodeStart[cell]; i < m_nodeStart[cell + 1]; i++)
+			{
+				int v = m_nodes[i];
+				double dx = xOf(graph.longitudeOf(v)) - x, dy = graph.latitudeOf(v) - y;
+				double squared = dx * dx + dy * dy;
+				if (squared < bestSquared || (squared == bestSquared && v < best))
+				{
+					best = v;
+					bestSquared = squared;
+				}
+			}
+		});
+		if (!inGrid)
+			break;
+	}
+	return best;
+}
+
+bool SpatialIndex::nearestPointOnSegment(double latitude, double longitude, SnapPoint& snap) const
+{
+	if (m_segments.empty())
+		return false;
+	const StreetGraph& graph = *m_graph;
+	double x = xOf(longitude), y = latitude;
+	int column = columnOf(x), row = rowOf(y);
+	double outside = distanceOutside(x, y, column, row);
+
+	//a segment crossing several cells is met more than once; measuring it again is cheaper
+	//than remembering which have been measured
+	int best = -1;
+	double bestSquared = numeric_limits<double>::infinity(), bestFraction = 0;
+	for (int r = 0; ; r++)
+	{
+		double reach = max(outside, (r - 1) * m_cellSize);
+		if (best != -1 && reach * reach >= bestSquared)
+			break;
+		bool inGrid = visitRing(column, row, r, [&](int cell) {
+			for (int i = m_segmentStart[cell]; i < m_segmentStart[cell + 1]; i++)
+			{
+				int s = m_segments[i];
+				int from = m_segmentFrom[s], to = graph.edgeTarget(m_segmentEdge[s]);
+				double x1 = xOf(graph.longitudeOf(from)), y1 = graph.latitudeOf(from);
+				double dx = xOf(graph.longitudeOf(to)) - x1, dy = graph.latitudeOf(to) - y1;
+				double lengthSquared = dx * dx + dy * dy;
+				double t = lengthSquared > 0 ? ((x - x1) * dx + (y - y1) * dy) / lengthSquared : 0;
+				t = min(max(t, 0.0), 1.0);
+				double px = x1 + t * dx - x, py = y1 + t * dy - y;
+				double squared = px * px + py * py;
+				if (squared < bestSquared || (squared == bestSquared && s < best))
+				{
+					best = s;
+					bestSquared = squared;
+					bestFraction = t;
+				}
+			}
+		});
+		if (!inGrid)
+			break;
+	}
+
+	int from = m_segmentFrom[best], to = graph.edgeTarget(m_segmentEdge[best]);
+	snap.edge = m_segmentEdge[best];
+	snap.fraction = bestFraction;
+	snap.latitude = graph.latitudeOf(from) + bestFraction * (graph.latitudeOf(to) - graph.latitudeOf(from));
+	snap.longitude = graph.longitudeOf(from) + bestFraction * (graph.longitudeOf(to) - graph.longitudeOf(from));
+	snap.miles = milesBetween(latitude, longitude, snap.latitude, snap.longitude);
+	return true;
+}
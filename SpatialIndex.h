@@ -0,0 +1,65 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include "StreetGraph.h"
+#include <vector>
+
+// SpatialIndex.h
+// A uniform grid over a StreetGraph's nodes and segments, for finding what is nearest to a
+// coordinate that isn't exactly on the map (a raw GPS fix, say). A query looks at the cell the
+// coordinate falls in and then at rings of cells around it, stopping once the next ring is
+// too far away to hold anything closer than what has been found. With a couple of nodes per
+// cell that is a handful of cells per query, however big the map is.
+
+// the point of the map's segments nearest to some coordinate
+struct SnapPoint
+{
+	int edge;          // the segment, as the edge leaving its lower numbered end
+	double latitude;   // the point on it
+	double longitude;
+	double fraction;   // how far along the edge the point is: 0 at its start, 1 at its end
+	double miles;      // how far the coordinate is from the point
+};
+
+class SpatialIndex
+{
+public:
+	SpatialIndex();
+	// index graph's nodes and segments; the graph must outlive the index (or the next build)
+	void build(const StreetGraph& graph);
+	void clear();
+
+	// the node nearest to the coordinate, or -1 if there are no nodes
+	int nearestNode(double latitude, double longitude) const;
+	// the point on a segment nearest to the coordinate; false if there are no segments
+	bool nearestPointOnSegment(double latitude, double longitude, SnapPoint& snap) const;
+private:
+	const StreetGraph* m_graph;
+	// Positions are projected onto a plane with x = longitude * cos(middle latitude) and
+	// y = latitude, so that a cell is about as tall as it is wide. Only used to compare
+	// distances; the miles reported are great circle distances.
+	double m_xScale;
+	double m_minX, m_minY;
+	double m_cellSize;
+	int m_columns, m_rows;
+	std::vector<int> m_nodeStart;    // the nodes in cell c are m_nodes[m_nodeStart[c] .. m_nodeStart[c + 1] - 1]
+	std::vector<int> m_nodes;
+	std::vector<int> m_segmentStart; // likewise the segments whose bounding box touches each cell
+	std::vector<int> m_segments;
+	std::vector<int> m_segmentEdge;  // segment s is edge m_segmentEdge[s], leaving node m_segmentFrom[s]
+	std::vector<int> m_segmentFrom;
+
+	double xOf(double longitude) const { return longitude * m_xScale; }
+	int columnOf(double x) const;
+	int rowOf(double y) const;
+	double distanceOutside(double x, double y, int column, int row) const;
+	// visit(cell) for every cell of the grid in ring r around (column, row), the cells whose
+	// column and row both differ by at most r and one of them by exactly r; false once the
+	// ring lies wholly outside the grid
+	template<typename Visit>
+	bool visitRing(int column, int row, int r, Visit visit) const;
+	static void fillCells(std::vector<int>& start, std::vector<int>& items, int cellCount,
+		const std::vector<std::pair<int, int>>& cellItems);
+};
+
+#endif
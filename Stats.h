@@ -0,0 +1,93 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+
+// Stats.h
+// Counts and timings of what a call did, for finding out where a slow plan spent its time.
+// They are only collected when the project is built with GOOBER_STATS defined
+// (-DGOOBER_STATS); otherwise the code that gathers them compiles away and the stats handed
+// back stay zero.
+
+#ifdef GOOBER_STATS
+const bool statsEnabled = true;
+#else
+const bool statsEnabled = false;
+#endif
+
+// What finding one or more routes took.
+struct RouteStats
+{
+	RouteStats() : routes(0), cacheHits(0), nodesExpanded(0), edgesRelaxed(0), hashProbes(0), milliseconds(0) {}
+	long long routes;        // routes asked for
+	long long cacheHits;     // of those, how many a RouteCache answered without searching
+	long long nodesExpanded; // nodes taken off a search's open list and looked beyond
+	long long edgesRelaxed;  // segments looked along from them
+	long long hashProbes;    // hash table slots looked at to find the nodes at the ends
+	double milliseconds;
+	void add(const RouteStats& other)
+	{
+		routes += other.routes;
+		cacheHits += other.cacheHits;
+		nodesExpanded += other.nodesExpanded;
+		edgesRelaxed += other.edgesRelaxed;
+		hashProbes += other.hashProbes;
+		milliseconds += other.milliseconds;
+	}
+};
+
+// What ordering deliveries took, over all of its annealing chains.
+struct AnnealingStats
+{
+	AnnealingStats() : chains(0), iterations(0), accepted(0), milliseconds(0) {}
+	int chains;
+	long long iterations;
+	long long accepted;      // steps whose change to the tour was kept
+	double milliseconds;
+	double acceptanceRate() const { return iterations == 0 ? 0 : (double)accepted / iterations; }
+	void add(const AnnealingStats& other)
+	{
+		chains += other.chains;
+		iterations += other.iterations;
+		accepted += other.accepted;
+		milliseconds += other.milliseconds;
+	}
+};
+
+// What making a delivery plan took, stage by stage.
+struct PlanStats
+{
+	PlanStats() : measureMilliseconds(0), optimizeMilliseconds(0), routeMilliseconds(0),
+		commandMilliseconds(0), totalMilliseconds(0) {}
+	double measureMilliseconds;  // checking the stops and finding the road distances between them
+	double optimizeMilliseconds; // ordering the deliveries
+	double routeMilliseconds;    // routing the legs
+	double commandMilliseconds;  // turning the route into commands
+	double totalMilliseconds;
+	AnnealingStats annealing;
+	RouteStats routing;
+};
+
+// Adds the time between its construction and destruction to *milliseconds, when stats are
+// being collected and milliseconds isn't nullptr.
+class ScopedTimer
+{
+public:
+	ScopedTimer(double* milliseconds) : m_milliseconds(statsEnabled ? milliseconds : nullptr)
+	{
+		if (m_milliseconds != nullptr)
+			m_started = std::chrono::steady_clock::now();
+	}
+	~ScopedTimer()
+	{
+		if (m_milliseconds != nullptr)
+			*m_milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_started).count();
+	}
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+private:
+	double* m_milliseconds;
+	std::chrono::steady_clock::time_point m_started;
+};
+
+#endif
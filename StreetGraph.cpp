@@ -0,0 +1,452 @@
+#include "provided.h"
+#include "StreetGraph.h"
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <atomic>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+namespace
+{
+	//the fixed part at the start of a snapshot; the tables follow it in the order
+	//latitude, longitude, edgeLength (doubles), nodeKey, then coordText, nodeSlots, firstEdge,
+	//edgeTarget, edgeStreet, nameOffset (ints), then the text pool
+	struct SnapshotHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;   //SNAPSHOT_BYTE_ORDER as written, so foreign files are rejected
+		int32_t nodeCount;
+		int32_t edgeCount;
+		int32_t streetCount;
+		int32_t slotCount;
+		int32_t textSize;
+		int32_t unused;       //keeps the tables after the header 8-byte aligned
+	};
+
+	const char SNAPSHOT_MAGIC[8] = { 'G', 'O', 'O', 'B', 'E', 'R', 'S', 'M' };
+	const uint32_t SNAPSHOT_VERSION = 2;
+	const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+	//hands out the numbers StreetGraph::version returns
+	atomic<uint64_t> lastVersion(0);
+}
+
+StreetGraph::StreetGraph()
+{
+	m_mapping = nullptr;
+	m_mappingSize = 0;
+	pointAtBuiltTables();
+}
+
+StreetGraph::~StreetGraph()
+{
+	releaseSnapshot();
+}
+
+void StreetGraph::clear()
+{
+	releaseSnapshot();
+	m_built.latitude.clear();
+	m_built.longitude.clear();
+	m_built.nodeKey.clear();
+	m_built.coordText.clear();
+	m_built.nodeSlots.clear();
+	m_built.firstEdge.clear();
+	m_built.edgeTarget.clear();
+	m_built.edgeLength.clear();
+	m_built.edgeStreet.clear();
+	m_built.edgeSource.clear();
+	m_built.nameOffset.clear();
+	m_built.text.clear();
+	m_built.nameIndex.reset();
+	pointAtBuiltTables();
+}
+
+int StreetGraph::findNode(GeoKey key, long long* probes) const
+{
+	if (m_slotCount == 0)
+		return -1;
+	unsigned int mask = m_slotCount - 1;
+	int found = -1;
+	long long looked = 1;
+	for (unsigned int slot = hashGeoKey(key) & mask; m_nodeSlots[slot] != -1; slot = (slot + 1) & mask, looked++)
+	{
+		if (m_nodeKey[m_nodeSlots[slot]] == key)
+		{
+			found = m_nodeSlots[slot];
+			break;
+		}
+	}
+	if (probes != nullptr)
+		*probes += looked;
+	return found;
+}
+
+uint64_t StreetGraph::fingerprint() const
+{
+	//FNV-1a over each node's key and each edge's ends, length and street, in table order
+	uint64_t hash = 14695981039346656037ULL;
+	auto mix = [&hash](uint64_t value) {
+		for (int i = 0; i < 8; i++)
+		{
+			hash ^= (value >> (8 * i)) & 0xff;
+			hash *= 1099511628211ULL;
+		}
+	};
+	mix((uint64_t)m_nodeCount);
+	mix((uint64_t)m_edgeCount);
+	for (int node = 0; node < m_nodeCount; node++)
+	{
+		mix(m_nodeKey[node].bits);
+		mix((uint64_t)m_firstEdge[node]);
+	}
+	for (int edge = 0; edge < m_edgeCount; edge++)
+	{
+		uint64_t lengthBits;
+		memcpy(&lengthBits, &m_edgeLength[edge], sizeof(lengthBits));
+		mix((uint64_t)m_edgeTarget[edge]);
+		mix(lengthBits);
+		mix((uint64_t)m_edgeStreet[edge]);
+	}
+	return hash;
+}
+
+int StreetGraph::addText(const string& s)
+{
+	int offset = (int)m_built.text.size();
+	m_built.text.insert(m_built.text.end(), s.begin(), s.end());
+	m_built.text.push_back('\0');
+	return offset;
+}
+
+int StreetGraph::addNode(const CoordText& coord)
+{
+	Built& b = m_built;
+	if (2 * (b.latitude.size() + 1) > b.nodeSlots.size())
+		growNodeSlots();
+
+	//probe for the coordinate; if it isn't there, the empty slot we stop at is where it goes.
+	//Texts that only differ in formatting have the same key, so they share a node (and keep
+	//the text that was seen first).
+	unsigned int mask = (unsigned int)b.nodeSlots.size() - 1;
+	unsigned int slot = hashGeoKey(coord.key) & mask;
+	for (; b.nodeSlots[slot] != -1; slot = (slot + 1) & mask)
+	{
+		if (b.nodeKey[b.nodeSlots[slot]] == coord.key)
+			return b.nodeSlots[slot];
+	}
+
+	int id = (int)b.latitude.size();
+	b.nodeSlots[slot] = id;
+	b.latitude.push_back(coord.latitude);
+	b.longitude.push_back(coord.longitude);
+	b.nodeKey.push_back(coord.key);
+	b.coordText.push_back(addText(string(coord.latitudeText, coord.latitudeLength)));
+	b.coordText.push_back(addText(string(coord.longitudeText, coord.longitudeLength)));
+	return id;
+}
+
+//double the coordinate index (at least 8 slots), keeping it at most half full
+void StreetGraph::growNodeSlots()
+{
+	Built& b = m_built;
+	int slots = b.nodeSlots.empty() ? 8 : 2 * (int)b.nodeSlots.size();
+	b.nodeSlots.assign(slots, -1);
+	for (int i = 0; i < (int)b.latitude.size(); i++)
+	{
+		unsigned int slot = hashGeoKey(b.nodeKey[i]) & (slots - 1);
+		while (b.nodeSlots[slot] != -1)
+			slot = (slot + 1) & (slots - 1);
+		b.nodeSlots[slot] = i;
+	}
+}
+
+int StreetGraph::addStreet(const string& name)
+{
+	const int* known = m_built.nameIndex.find(name);
+	if (known != nullptr)
+		return *known;
+	int id = (int)m_built.nameOffset.size();
+	m_built.nameOffset.push_back(addText(name));
+	m_built.nameIndex.associate(name, id);
+	return id;
+}
+
+void StreetGraph::addSegment(int from, int to, int street, double length)
+{
+	m_built.edgeSource.push_back(from);
+	m_built.edgeTarget.push_back(to);
+	m_built.edgeStreet.push_back(street);
+	m_built.edgeLength.push_back(length);
+}
+
+void StreetGraph::finish()
+{
+	Built& b = m_built;
+
+	//counting sort the edges by their start node; edges that share a start node keep the
+	//order they were added in
+	int n = (int)b.latitude.size(), m = (int)b.edgeTarget.size();
+	if (b.nodeSlots.empty())
+		growNodeSlots();
+	b.firstEdge.assign(n + 1, 0);
+	for (int e = 0; e < m; e++)
+		b.firstEdge[b.edgeSource[e] + 1]++;
+	for (int i = 0; i < n; i++)
+		b.firstEdge[i + 1] += b.firstEdge[i];
+
+	vector<int> next(b.firstEdge.begin(), b.firstEdge.end() - 1);
+	vector<int> target(m), street(m);
+	vector<double> length(m);
+	for (int e = 0; e < m; e++)
+	{
+		int slot = next[b.edgeSource[e]]++;
+		target[slot] = b.edgeTarget[e];
+		street[slot] = b.edgeStreet[e];
+		length[slot] = b.edgeLength[e];
+	}
+	b.edgeTarget.swap(target);
+	b.edgeStreet.swap(street);
+	b.edgeLength.swap(length);
+	vector<int>().swap(b.edgeSource);
+	b.nameIndex.reset();
+
+	pointAtBuiltTables();
+}
+
+void StreetGraph::pointAtBuiltTables()
+{
+	m_nodeCount = (int)m_built.latitude.size();
+	m_edgeCount = (int)m_built.edgeTarget.size();
+	m_streetCount = (int)m_built.nameOffset.size();
+	m_slotCount = (int)m_built.nodeSlots.size();
+	m_latitude = m_built.latitude.data();
+	m_longitude = m_built.longitude.data();
+	m_nodeKey = m_built.nodeKey.data();
+	m_coordText = m_built.coordText.data();
+	m_nodeSlots = m_built.nodeSlots.data();
+	m_firstEdge = m_built.firstEdge.data();
+	m_edgeTarget = m_built.edgeTarget.data();
+	m_edgeLength = m_built.edgeLength.data();
+	m_edgeStreet = m_built.edgeStreet.data();
+	m_nameOffset = m_built.nameOffset.data();
+	m_text = m_built.text.data();
+	m_textSize = (int)m_built.text.size();
+	m_version = ++lastVersion;
+}
+
+bool StreetGraph::saveSnapshot(const string& file) const
+{
+	ofstream out(file, ios::binary);
+	if (!out)
+		return false;
+
+	SnapshotHeader h;
+	memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+	h.version = SNAPSHOT_VERSION;
+	h.byteOrder = SNAPSHOT_BYTE_ORDER;
+	h.nodeCount = m_nodeCount;
+	h.edgeCount = m_edgeCount;
+	h.streetCount = m_streetCount;
+	h.slotCount = m_slotCount;
+	h.textSize = m_textSize;
+	h.unused = 0;
+
+	size_t n = m_nodeCount, m = m_edgeCount;
+	out.write((const char*)&h, sizeof(h));
+	out.write((const char*)m_latitude, sizeof(double) * n);
+	out.write((const char*)m_longitude, sizeof(double) * n);
+	out.write((const char*)m_edgeLength, sizeof(double) * m);
+	out.write((const char*)m_nodeKey, sizeof(GeoKey) * n);
+	out.write((const char*)m_coordText, sizeof(int32_t) * 2 * n);
+	out.write((const char*)m_nodeSlots, sizeof(int32_t) * m_slotCount);
+	out.write((const char*)m_firstEdge, sizeof(int32_t) * (n + 1));
+	out.write((const char*)m_edgeTarget, sizeof(int32_t) * m);
+	out.write((const char*)m_edgeStreet, sizeof(int32_t) * m);
+	out.write((const char*)m_nameOffset, sizeof(int32_t) * m_streetCount);
+	out.write(m_text, m_textSize);
+	return (bool)out;
+}
+
+//where each table sits in a snapshot image
+struct StreetGraph::SnapshotTables
+{
+	const SnapshotHeader* header;
+	const double* latitude;
+	const double* longitude;
+	const double* edgeLength;
+	const GeoKey* nodeKey;
+	const int* coordText;
+	const int* nodeSlots;
+	const int* firstEdge;
+	const int* edgeTarget;
+	const int* edgeStreet;
+	const int* nameOffset;
+	const char* text;
+};
+
+bool StreetGraph::loadSnapshot(const string& file)
+{
+	//the new image is mapped and checked before the current graph is let go of, so a file
+	//that can't be used leaves whatever was loaded before in place
+	SnapshotTables tables;
+#if !defined(_WIN32)
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(SnapshotHeader))
+	{
+		close(fd);
+		return false;
+	}
+	size_t size = (size_t)info.st_size;
+	void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);  //the mapping stays valid after the descriptor is closed
+	if (mapping == MAP_FAILED)
+		return false;
+	if (!findSnapshotTables((const char*)mapping, size, tables))
+	{
+		munmap(mapping, size);
+		return false;
+	}
+	clear();
+	m_mapping = mapping;
+	m_mappingSize = size;
+#else
+	//no mmap: read the whole image into a buffer of doubles so the tables stay aligned
+	ifstream in(file, ios::binary | ios::ate);
+	if (!in)
+		return false;
+	size_t size = (size_t)in.tellg();
+	vector<double> buffer(size / sizeof(double) + 1);
+	in.seekg(0);
+	if (!in.read((char*)buffer.data(), size) || !findSnapshotTables((const char*)buffer.data(), size, tables))
+		return false;
+	clear();
+	m_fileBuffer.swap(buffer);  //swapping keeps the data where tables points
+#endif
+	pointAtSnapshot(tables);
+	return true;
+}
+
+//check an image and find its tables, touching nothing in the graph; besides the header, this
+//checks that every table fits in the image and that every index and offset stored in the
+//tables is in range, so a damaged file can't send a later lookup outside them
+bool StreetGraph::findSnapshotTables(const char* image, size_t size, SnapshotTables& tables)
+{
+	if (size < sizeof(SnapshotHeader))
+		return false;
+	const SnapshotHeader& h = *(const SnapshotHeader*)image;
+	if (memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0 || h.version != SNAPSHOT_VERSION ||
+		h.byteOrder != SNAPSHOT_BYTE_ORDER || h.nodeCount < 0 || h.edgeCount < 0 || h.streetCount < 0 ||
+		h.slotCount < 0 || (h.slotCount & (h.slotCount - 1)) != 0 || h.textSize < 0)
+		return false;
+
+	//lay the tables out one after another, failing as soon as one would run past the end
+	const char* p = image + sizeof(SnapshotHeader);
+	size_t left = size - sizeof(SnapshotHeader);
+	bool fits = true;
+	auto take = [&](size_t count, size_t width) {
+		const char* table = p;
+		if (!fits || count > left / width)
+			fits = false;
+		else
+		{
+			p += count * width;
+			left -= count * width;
+		}
+		return table;
+	};
+	size_t n = h.nodeCount, m = h.edgeCount;
+	tables.header = &h;
+	tables.latitude = (const double*)take(n, sizeof(double));
+	tables.longitude = (const double*)take(n, sizeof(double));
+	tables.edgeLength = (const double*)take(m, sizeof(double));
+	tables.nodeKey = (const GeoKey*)take(n, sizeof(GeoKey));
+	tables.coordText = (const int*)take(2 * n, sizeof(int32_t));
+	tables.nodeSlots = (const int*)take(h.slotCount, sizeof(int32_t));
+	tables.firstEdge = (const int*)take(n + 1, sizeof(int32_t));
+	tables.edgeTarget = (const int*)take(m, sizeof(int32_t));
+	tables.edgeStreet = (const int*)take(m, sizeof(int32_t));
+	tables.nameOffset = (const int*)take(h.streetCount, sizeof(int32_t));
+	tables.text = take(h.textSize, 1);
+	if (!fits || left != 0)
+		return false;
+
+	//every string has to end inside the pool, which its last '\0' guarantees
+	if (h.textSize > 0 && tables.text[h.textSize - 1] != '\0')
+		return false;
+	for (size_t i = 0; i < 2 * n; i++)
+		if (tables.coordText[i] < 0 || tables.coordText[i] >= h.textSize)
+			return false;
+	for (int s = 0; s < h.streetCount; s++)
+		if (tables.nameOffset[s] < 0 || tables.nameOffset[s] >= h.textSize)
+			return false;
+
+	//findNode probes until it finds an empty slot, so there has to be one
+	bool emptySlot = false;
+	for (int slot = 0; slot < h.slotCount; slot++)
+	{
+		if (tables.nodeSlots[slot] == -1)
+			emptySlot = true;
+		else if (tables.nodeSlots[slot] < 0 || tables.nodeSlots[slot] >= h.nodeCount)
+			return false;
+	}
+	if (h.slotCount > 0 && !emptySlot)
+		return false;
+
+	if (tables.firstEdge[0] != 0 || tables.firstEdge[n] != h.edgeCount)
+		return false;
+	for (size_t v = 0; v < n; v++)
+		if (tables.firstEdge[v] > tables.firstEdge[v + 1])
+			return false;
+	for (size_t e = 0; e < m; e++)
+		if (tables.edgeTarget[e] < 0 || tables.edgeTarget[e] >= h.nodeCount ||
+			tables.edgeStreet[e] < 0 || tables.edgeStreet[e] >= h.streetCount)
+			return false;
+	return true;
+}
+
+//point every table into an image findSnapshotTables accepted
+void StreetGraph::pointAtSnapshot(const SnapshotTables& tables)
+{
+	const SnapshotHeader& h = *tables.header;
+	m_latitude = tables.latitude;
+	m_longitude = tables.longitude;
+	m_edgeLength = tables.edgeLength;
+	m_nodeKey = tables.nodeKey;
+	m_coordText = tables.coordText;
+	m_nodeSlots = tables.nodeSlots;
+	m_firstEdge = tables.firstEdge;
+	m_edgeTarget = tables.edgeTarget;
+	m_edgeStreet = tables.edgeStreet;
+	m_nameOffset = tables.nameOffset;
+	m_text = tables.text;
+	m_nodeCount = h.nodeCount;
+	m_edgeCount = h.edgeCount;
+	m_streetCount = h.streetCount;
+	m_slotCount = h.slotCount;
+	m_textSize = h.textSize;
+	m_version = ++lastVersion;
+}
+
+void StreetGraph::releaseSnapshot()
+{
+#if !defined(_WIN32)
+	if (m_mapping != nullptr)
+		munmap(m_mapping, m_mappingSize);
+#endif
+	m_mapping = nullptr;
+	m_mappingSize = 0;
+	vector<double>().swap(m_fileBuffer);
+}
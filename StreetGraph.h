@@ -0,0 +1,334 @@
+#ifndef STREETGRAPH_H
+#define STREETGRAPH_H
+
+#include "provided.h"
+#include "ExpandableHashMap.h"
+#include <string>
+#include <vector>
+#include <list>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// StreetGraph.h
+// The street map as a compressed sparse row graph. Every distinct GeoCoord gets a dense
+// node ID, the segments leaving node n are the edges firstEdge(n) .. firstEdge(n + 1) - 1,
+// and each edge carries its end node, its length in miles and the ID of its street's name.
+// Routing only ever touches these arrays; GeoCoords and names are only built for output.
+
+// A coordinate's canonical key: latitude and longitude as whole numbers of 1e-7 degrees (the
+// precision of the map data), offset to be non-negative and packed into 64 bits. Texts like
+// "34.05" and "34.0500000" get the same key, and making or hashing one never allocates.
+struct GeoKey
+{
+	uint64_t bits;
+	bool operator==(const GeoKey& other) const { return bits == other.bits; }
+	bool operator!=(const GeoKey& other) const { return bits != other.bits; }
+};
+
+inline GeoKey geoKey(double latitude, double longitude)
+{
+	GeoKey key;
+	uint64_t lat = (uint64_t)(std::llround(latitude * 1e7) + 900000000LL);
+	uint64_t lon = (uint64_t)(std::llround(longitude * 1e7) + 1800000000LL);
+	key.bits = (lat << 32) | (lon & 0xffffffffu);
+	return key;
+}
+
+inline GeoKey geoKey(const GeoCoord& gc)
+{
+	return geoKey(gc.latitude, gc.longitude);
+}
+
+// mixes all 64 bits into the result (the finalizer of MurmurHash3), so nearby coordinates
+// land far apart
+inline unsigned int hashGeoKey(GeoKey key)
+{
+	uint64_t h = key.bits;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return (unsigned int)h;
+}
+
+class StreetGraph;
+
+// One segment as the graph stores it. It refers into the graph's tables rather than copying
+// them, so it is only valid while the graph is.
+class SegmentRef
+{
+public:
+	SegmentRef(const StreetGraph* graph, int from, int edge) : m_graph(graph), m_from(from), m_edge(edge) {}
+	int edge() const { return m_edge; }
+	int startNode() const { return m_from; }
+	inline int endNode() const;
+	inline double length() const;
+	inline int street() const;
+	inline const char* streetName() const;
+	// the direction the segment heads in, measured as angleOfLine does, and the angle from it
+	// to next as angleBetween2Lines measures it, without building StreetSegments to ask them
+	inline double bearing() const;
+	inline double angleTo(const SegmentRef& next) const;
+	// a copy in the form provided.h uses
+	inline StreetSegment toStreetSegment() const;
+private:
+	const StreetGraph* m_graph;
+	int m_from;
+	int m_edge;
+
+	inline double radians() const;
+};
+
+// The segments that start at one node, usable in a range-based for loop.
+class SegmentRange
+{
+public:
+	class iterator
+	{
+	public:
+		iterator(const StreetGraph* graph, int from, int edge) : m_graph(graph), m_from(from), m_edge(edge) {}
+		SegmentRef operator*() const { return SegmentRef(m_graph, m_from, m_edge); }
+		iterator& operator++() { m_edge++; return *this; }
+		bool operator==(const iterator& other) const { return m_edge == other.m_edge; }
+		bool operator!=(const iterator& other) const { return m_edge != other.m_edge; }
+	private:
+		const StreetGraph* m_graph;
+		int m_from;
+		int m_edge;
+	};
+
+	SegmentRange() : m_graph(nullptr), m_from(-1), m_begin(0), m_end(0) {}
+	SegmentRange(const StreetGraph* graph, int from, int begin, int end)
+		: m_graph(graph), m_from(from), m_begin(begin), m_end(end) {}
+	iterator begin() const { return iterator(m_graph, m_from, m_begin); }
+	iterator end() const { return iterator(m_graph, m_from, m_end); }
+	int size() const { return m_end - m_begin; }
+	bool empty() const { return m_begin == m_end; }
+	SegmentRef operator[](int i) const { return SegmentRef(m_graph, m_from, m_begin + i); }
+private:
+	const StreetGraph* m_graph;
+	int m_from;
+	int m_begin;
+	int m_end;
+};
+
+// A route as the graph edges it takes, one after another, and the nodes it passes (the start,
+// then the end of each edge). Its segments are SegmentRefs, so street names are only looked up
+// in the graph's name table when asked for, and a route of any length is just two arrays.
+class Route
+{
+public:
+	Route() : m_graph(nullptr) {}
+	// make this the empty route standing at node start of graph
+	void begin(const StreetGraph* graph, int start) { m_graph = graph; m_nodes.assign(1, start); m_edges.clear(); }
+	void clear() { m_graph = nullptr; m_nodes.clear(); m_edges.clear(); }
+	// drive edge next, which must leave endNode()
+	inline void append(int edge);
+	// carry on along other, which must start at endNode() (or this route must be empty)
+	void append(const Route& other)
+	{
+		if (m_nodes.empty())
+		{
+			*this = other;
+			return;
+		}
+		m_nodes.insert(m_nodes.end(), other.m_nodes.begin() + 1, other.m_nodes.end());
+		m_edges.insert(m_edges.end(), other.m_edges.begin(), other.m_edges.end());
+	}
+
+	int size() const { return (int)m_edges.size(); }
+	bool empty() const { return m_edges.empty(); }
+	SegmentRef operator[](int i) const { return SegmentRef(m_graph, m_nodes[i], m_edges[i]); }
+	const std::vector<int>& nodes() const { return m_nodes; }
+	const std::vector<int>& edges() const { return m_edges; }
+	inline double length() const;
+	// the route in the form provided.h uses, appended to segs
+	inline void appendTo(std::list<StreetSegment>& segs) const;
+private:
+	const StreetGraph* m_graph;
+	std::vector<int> m_nodes;
+	std::vector<int> m_edges;
+};
+
+class StreetGraph
+{
+public:
+	StreetGraph();
+	~StreetGraph();
+	void clear();
+
+	int nodeCount() const { return m_nodeCount; }
+	int edgeCount() const { return m_edgeCount; }
+	int streetCount() const { return m_streetCount; }
+	// changes whenever the graph does (it is loaded, cleared or built), and is never the same
+	// for two different graphs, so anything derived from a graph can tell when it is stale
+	uint64_t version() const { return m_version; }
+	// a hash of the nodes and edges: the same for the same map however it was loaded, and
+	// (all but certainly) different for any other, so something saved alongside a map can
+	// check it still describes it. It takes a pass over the whole graph.
+	uint64_t fingerprint() const;
+
+	// the node at gc, or -1 if gc isn't the end of any segment; adds the number of hash slots
+	// looked at to *probes if it isn't nullptr
+	int findNode(const GeoCoord& gc, long long* probes = nullptr) const { return findNode(geoKey(gc), probes); }
+	int findNode(GeoKey key, long long* probes = nullptr) const;
+	GeoCoord coordOf(int node) const
+	{
+		return GeoCoord(m_text + m_coordText[2 * node], m_text + m_coordText[2 * node + 1]);
+	}
+	double latitudeOf(int node) const { return m_latitude[node]; }
+	double longitudeOf(int node) const { return m_longitude[node]; }
+
+	int firstEdge(int node) const { return m_firstEdge[node]; }
+	int edgeTarget(int edge) const { return m_edgeTarget[edge]; }
+	double edgeLength(int edge) const { return m_edgeLength[edge]; }
+	int edgeStreet(int edge) const { return m_edgeStreet[edge]; }
+	const char* streetName(int street) const { return m_text + m_nameOffset[street]; }
+
+	// the segments leaving node, without copying anything
+	SegmentRange segmentsFrom(int node) const
+	{
+		return SegmentRange(this, node, m_firstEdge[node], m_firstEdge[node + 1]);
+	}
+
+	// straight line distance between two nodes, the same formula as distanceEarthMiles
+	double crowMiles(int a, int b) const;
+
+	// a coordinate as it appears in a map file, already scanned
+	struct CoordText
+	{
+		const char* latitudeText;
+		int latitudeLength;
+		const char* longitudeText;
+		int longitudeLength;
+		double latitude;
+		double longitude;
+		GeoKey key;           // geoKey(latitude, longitude)
+	};
+
+	// building: add nodes, streets and segments (the nodes and street a segment refers to
+	// must be added first), then call finish()
+	int addNode(const CoordText& coord);
+	int addStreet(const std::string& name);
+	void addSegment(int from, int to, int street, double length);
+	void finish();
+
+	// A snapshot is a binary image of the finished tables. Loading one maps the file into
+	// memory and reads the tables straight out of it, with no parsing at all. A file that can't
+	// be read or fails its checks leaves the graph as it was.
+	bool saveSnapshot(const std::string& file) const;
+	bool loadSnapshot(const std::string& file);
+
+	StreetGraph(const StreetGraph&) = delete;
+	StreetGraph& operator=(const StreetGraph&) = delete;
+private:
+	// the tables everything reads from: either the vectors in m_built, or a mapped snapshot
+	int m_nodeCount;
+	int m_edgeCount;
+	int m_streetCount;
+	int m_slotCount;                   // size of m_nodeSlots, a power of two
+	const double* m_latitude;
+	const double* m_longitude;
+	const int* m_coordText;            // two offsets into m_text per node
+	const GeoKey* m_nodeKey;
+	const int* m_nodeSlots;            // open-addressing index from node key to node, -1 = empty
+	const int* m_firstEdge;
+	const int* m_edgeTarget;
+	const double* m_edgeLength;
+	const int* m_edgeStreet;
+	const int* m_nameOffset;
+	const char* m_text;                // every coordinate text and street name, each followed by a '\0'
+	int m_textSize;
+	uint64_t m_version;
+
+	// storage for a graph built from a text map
+	struct Built
+	{
+		std::vector<double> latitude;
+		std::vector<double> longitude;
+		std::vector<GeoKey> nodeKey;
+		std::vector<int> coordText;
+		std::vector<int> nodeSlots;    // grown as nodes are added
+		std::vector<int> firstEdge;
+		std::vector<int> edgeTarget;
+		std::vector<double> edgeLength;
+		std::vector<int> edgeStreet;
+		std::vector<int> edgeSource;   // only needed until finish()
+		std::vector<int> nameOffset;
+		std::vector<char> text;
+		ExpandableHashMap<std::string, int> nameIndex; // only needed until finish()
+	};
+	Built m_built;
+
+	// storage for a loaded snapshot
+	void* m_mapping;
+	size_t m_mappingSize;
+	std::vector<double> m_fileBuffer;  // used instead of a mapping where mmap isn't available
+
+	int addText(const std::string& s);
+	void growNodeSlots();
+	void pointAtBuiltTables();
+	struct SnapshotTables;
+	static bool findSnapshotTables(const char* image, size_t size, SnapshotTables& tables);
+	void pointAtSnapshot(const SnapshotTables& tables);
+	void releaseSnapshot();
+};
+
+inline int SegmentRef::endNode() const { return m_graph->edgeTarget(m_edge); }
+inline double SegmentRef::length() const { return m_graph->edgeLength(m_edge); }
+inline int SegmentRef::street() const { return m_graph->edgeStreet(m_edge); }
+inline const char* SegmentRef::streetName() const { return m_graph->streetName(street()); }
+inline double SegmentRef::radians() const
+{
+	int to = endNode();
+	return std::atan2(m_graph->latitudeOf(to) - m_graph->latitudeOf(m_from),
+		m_graph->longitudeOf(to) - m_graph->longitudeOf(m_from));
+}
+inline double SegmentRef::bearing() const
+{
+	double angle = rad2deg(radians());
+	return angle < 0 ? angle + 360 : angle;
+}
+inline double SegmentRef::angleTo(const SegmentRef& next) const
+{
+	double angle = rad2deg(next.radians() - radians());
+	return angle < 0 ? angle + 360 : angle;
+}
+inline StreetSegment SegmentRef::toStreetSegment() const
+{
+	return StreetSegment(m_graph->coordOf(m_from), m_graph->coordOf(endNode()), streetName());
+}
+
+inline void Route::append(int edge)
+{
+	m_nodes.push_back(m_graph->edgeTarget(edge));
+	m_edges.push_back(edge);
+}
+
+inline double Route::length() const
+{
+	double total = 0;
+	for (int i = 0; i < (int)m_edges.size(); i++)
+		total += m_graph->edgeLength(m_edges[i]);
+	return total;
+}
+
+inline void Route::appendTo(std::list<StreetSegment>& segs) const
+{
+	for (int i = 0; i < (int)m_edges.size(); i++)
+		segs.push_back((*this)[i].toStreetSegment());
+}
+
+inline double StreetGraph::crowMiles(int a, int b) const
+{
+	const double toRadians = 4 * std::atan(1.0) / 180;
+	const double earthRadiusMiles = 6371.0 / 1.609344;
+	double lat1 = m_latitude[a] * toRadians, lat2 = m_latitude[b] * toRadians;
+	double u = std::sin((lat2 - lat1) / 2);
+	double v = std::sin((m_longitude[b] - m_longitude[a]) * toRadians / 2);
+	return 2.0 * earthRadiusMiles * std::asin(std::sqrt(u * u + std::cos(lat1) * std::cos(lat2) * v * v));
+}
+
+#endif
@@ -1,16 +1,31 @@
 #include "provided.h"
+#include "support.h"
 #include <string>
 #include <vector>
 #include <functional>
 #include <fstream>
 #include <sstream>
+#include <charconv>
+#include <thread>
+#include <cstring>
+#include <cctype>
 #include "ExpandableHashMap.h" 
 using namespace std;
 
 
 unsigned int hasher(const GeoCoord& g)
 {
-	return std::hash<string>()(g.latitudeText + g.longitudeText);
+	return hashGeoKey(geoKey(g));
+}
+
+unsigned int hasher(const GeoKey& k)
+{
+	return hashGeoKey(k);
+}
+
+unsigned int hasher(const string& s)
+{
+	return std::hash<string>()(s);
 }
 
 class StreetMapImpl
@@ -20,8 +35,39 @@ public:
 	~StreetMapImpl();
 	bool load(string mapFile);
 	bool getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const;
+	bool getSegmentsThatStartWith(const GeoCoord& gc, SegmentRange& segs) const;
+	bool saveSnapshot(string snapshotFile) const { return streetGraph.saveSnapshot(snapshotFile); }
+	bool loadSnapshot(string snapshotFile);
+	const StreetGraph& graph() const { return streetGraph; }
+	const SpatialIndex& index() const { return spatialIndex; }
+	bool loadTravelTimes(string speedFile) { return travelTimes.load(streetGraph, speedFile); }
+	const TravelTimes& times() const { return travelTimes; }
 private:
-	ExpandableHashMap<GeoCoord, vector<StreetSegment>> coord2seg;
+	StreetGraph streetGraph;
+	//both rebuilt whenever streetGraph is; a new map starts with every segment at the default speed
+	SpatialIndex spatialIndex;
+	TravelTimes travelTimes;
+
+	//one street's record in the map file: a name line, a count line, then one line per segment
+	struct StreetRecord
+	{
+		const char* name;
+		int nameLength;
+		const char* firstSegmentLine;
+		int segmentCount; //how many segment lines really follow, in case the file ends early
+	};
+	//one segment line, scanned
+	struct ScannedSegment
+	{
+		StreetGraph::CoordText start;
+		StreetGraph::CoordText end;
+		double length;
+	};
+
+	static const char* endOfLine(const char* p, const char* fileEnd);
+	static bool scanCoord(const char*& p, const char* lineEnd, StreetGraph::CoordText& coord);
+	static bool scanSegments(const StreetRecord* first, const StreetRecord* last, const char* fileEnd,
+		vector<ScannedSegment>& segments);
 };
 
 StreetMapImpl::StreetMapImpl()
@@ -35,78 +81,183 @@ StreetMapImpl::~StreetMapImpl()
 bool StreetMapImpl::load(string mapFile)
 {
 	//return false;  // Delete this line and implement this function correctly
-	ifstream i1(mapFile);    // infile is a name of our choosing
+	ifstream i1(mapFile, ios::binary);    // infile is a name of our choosing
 	if (!i1)		        // Did opening the file fail?
 	{
 		cerr << "Error: Cannot open mapdata.txt!" << endl;
 		return false;
 	}
+	stringstream contents;
+	contents << i1.rdbuf();
+	string text = contents.str();
+	const char* p = text.data();
+	const char* fileEnd = p + text.size();
 
-	string line;
-	int count = 0; //to keep track of which line/type of data we are extracting
-	string nameOfStreet;
-	int k = 0, i = 0; //k = the # of street segments per street
-					  //i = iterator to go through all k street segments
-
-	while (getline(i1, line))
+	//first find where each street's record starts. This has to be done in order, since a
+	//record's length is only known from its count line, but it only looks for line ends.
+	vector<StreetRecord> records;
+	int totalSegments = 0;
+	while (p < fileEnd)
 	{
-		istringstream iss(line);
-		if (count == 0)
+		StreetRecord record;
+		const char* eol = endOfLine(p, fileEnd);
+		record.name = p;
+		record.nameLength = (int)(eol - p);
+		p = eol + 1;
+		if (p >= fileEnd)
+			break;
+
+		eol = endOfLine(p, fileEnd);
+		int k = 0; //the # of street segments for this street
+		while (p < eol && (*p == ' ' || *p == '\t'))
+			p++;
+		from_chars(p, eol, k);
+		p = eol + 1;
+
+		record.firstSegmentLine = p;
+		record.segmentCount = 0;
+		while (record.segmentCount < k && p < fileEnd)
 		{
-			nameOfStreet = line;
-			count++;
+			p = endOfLine(p, fileEnd) + 1;
+			record.segmentCount++;
 		}
-		else if (count == 1)
+		totalSegments += record.segmentCount;
+		records.push_back(record);
+	}
+
+	//then scan the segment lines, giving each thread a run of whole records with about the
+	//same number of segments. Small maps aren't worth starting threads for.
+	int threads = (int)thread::hardware_concurrency();
+	if (threads < 1 || totalSegments < 20000)
+		threads = 1;
+	vector<int> firstRecord(1, 0);
+	for (int r = 0, seen = 0; r < (int)records.size(); r++)
+	{
+		seen += records[r].segmentCount;
+		if ((long long)seen * threads >= (long long)totalSegments * (int)firstRecord.size() && (int)firstRecord.size() < threads)
+			firstRecord.push_back(r + 1);
+	}
+	while ((int)firstRecord.size() <= threads)
+		firstRecord.push_back((int)records.size());
+
+	vector<vector<ScannedSegment>> scanned(threads);
+	vector<char> scannedOK(threads, false);
+	vector<thread> workers;
+	const StreetRecord* base = records.data();
+	for (int t = 1; t < threads; t++)
+	{
+		workers.push_back(thread([&, t]() {
+			scannedOK[t] = scanSegments(base + firstRecord[t], base + firstRecord[t + 1], fileEnd, scanned[t]);
+		}));
+	}
+	scannedOK[0] = scanSegments(base + firstRecord[0], base + firstRecord[1], fileEnd, scanned[0]);
+	for (int t = 0; t < (int)workers.size(); t++)
+		workers[t].join();
+	for (int t = 0; t < threads; t++)
+	{
+		if (!scannedOK[t])
 		{
-			iss >> k;
-			count++;
+			cerr << "Error: Bad segment line in " << mapFile << endl;
+			return false;
 		}
-		else if (count == 2)
+	}
+
+	//finally add everything to the graph in file order, so that the segments starting at each
+	//location come out in the same order as if the file had been read line by line
+	streetGraph.clear();
+	for (int t = 0; t < threads; t++)
+	{
+		int next = 0;
+		for (int r = firstRecord[t]; r < firstRecord[t + 1]; r++)
 		{
-			string lat1, lat2, lon1, lon2;
+			int street = streetGraph.addStreet(string(records[r].name, records[r].nameLength));
+			for (int i = 0; i < records[r].segmentCount; i++, next++)
+			{
+				const ScannedSegment& seg = scanned[t][next];
 
-			iss >> lat1;
-			iss >> lon1;
-			iss >> lat2;
-			iss >> lon2;
+				//every segment can be travelled both ways, so add it once from each end
+				int startNode = streetGraph.addNode(seg.start);
+				int endNode = streetGraph.addNode(seg.end);
+				streetGraph.addSegment(startNode, endNode, street, seg.length);
+				streetGraph.addSegment(endNode, startNode, street, seg.length);
+			}
+		}
+	}
+	//lay the segments out by start location, and index where they are
+	streetGraph.finish();
+	spatialIndex.build(streetGraph);
+	travelTimes.reset(streetGraph);
+	return true;
+}
 
-			GeoCoord start(lat1, lon1), end(lat2, lon2);
+bool StreetMapImpl::loadSnapshot(string snapshotFile)
+{
+	if (!streetGraph.loadSnapshot(snapshotFile))
+		return false;
+	spatialIndex.build(streetGraph);
+	travelTimes.reset(streetGraph);
+	return true;
+}
 
-			StreetSegment S1(start, end, nameOfStreet);
-			StreetSegment S2(end, start, nameOfStreet);
+//the end of the line starting at p: its '\n', or the end of the file
+const char* StreetMapImpl::endOfLine(const char* p, const char* fileEnd)
+{
+	const char* eol = (const char*)memchr(p, '\n', fileEnd - p);
+	return eol == nullptr ? fileEnd : eol;
+}
 
-			i++;
-			
-			//map the coordinates to a vector of segments
-			if (coord2seg.find(start) != nullptr)
-			{
-				coord2seg.find(start)->push_back(S1);
-			}
-			else
-			{
-				vector<StreetSegment> segV1;
-				segV1.push_back(S1);
-				coord2seg.associate(start, segV1);
-			}
-			if (coord2seg.find(end) != nullptr)
-			{
-				coord2seg.find(end)->push_back(S2);
-			}
-			else
-			{
-				vector <StreetSegment> segV2;
-				segV2.push_back(S2);
-				coord2seg.associate(end, segV2);
-			}
+//scan "latitude longitude" starting at p, leaving p just past it
+bool StreetMapImpl::scanCoord(const char*& p, const char* lineEnd, StreetGraph::CoordText& coord)
+{
+	const char* token[2];
+	int length[2];
+	double value[2];
+	for (int i = 0; i < 2; i++)
+	{
+		while (p < lineEnd && isspace((unsigned char)*p))
+			p++;
+		token[i] = p;
+		while (p < lineEnd && !isspace((unsigned char)*p))
+			p++;
+		length[i] = (int)(p - token[i]);
+		//the same value GeoCoord's constructor would get by calling stod on the text
+		if (length[i] == 0 || from_chars(token[i], p, value[i]).ec != errc())
+			return false;
+	}
+	coord.latitudeText = token[0];
+	coord.latitudeLength = length[0];
+	coord.longitudeText = token[1];
+	coord.longitudeLength = length[1];
+	coord.latitude = value[0];
+	coord.longitude = value[1];
+	coord.key = geoKey(value[0], value[1]);
+	return true;
+}
 
-			//if all the segments have already been extracted, set count to 0 so that the next
-			//thing to be extracted is the name of the next street
-			if (i == k)
-			{
-				count = 0;
-				i = 0;
-			}
-			
+//scan every segment line of the records from first up to (not including) last
+bool StreetMapImpl::scanSegments(const StreetRecord* first, const StreetRecord* last, const char* fileEnd,
+	vector<ScannedSegment>& segments)
+{
+	for (const StreetRecord* r = first; r != last; r++)
+	{
+		const char* p = r->firstSegmentLine;
+		for (int i = 0; i < r->segmentCount; i++)
+		{
+			const char* eol = endOfLine(p, fileEnd);
+			ScannedSegment seg;
+			if (!scanCoord(p, eol, seg.start) || !scanCoord(p, eol, seg.end))
+				return false;
+
+			//distanceEarthMiles only looks at the numeric coordinates, so skip building the texts
+			GeoCoord start, end;
+			start.latitude = seg.start.latitude;
+			start.longitude = seg.start.longitude;
+			end.latitude = seg.end.latitude;
+			end.longitude = seg.end.longitude;
+			seg.length = distanceEarthMiles(start, end);
+
+			segments.push_back(seg);
+			p = eol + 1;
 		}
 	}
 	return true;
@@ -114,12 +265,23 @@ bool StreetMapImpl::load(string mapFile)
 
 bool StreetMapImpl::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const
 {
-	if (coord2seg.find(gc) != nullptr)
-	{
-		segs = *coord2seg.find(gc);
-		return true;
-	}
-	return false;
+	SegmentRange range;
+	if (!getSegmentsThatStartWith(gc, range))
+		return false;
+
+	segs.clear();
+	for (SegmentRef seg : range)
+		segs.push_back(seg.toStreetSegment());
+	return true;
+}
+
+bool StreetMapImpl::getSegmentsThatStartWith(const GeoCoord& gc, SegmentRange& segs) const
+{
+	int node = streetGraph.findNode(gc);
+	if (node == -1)
+		return false;
+	segs = streetGraph.segmentsFrom(node);
+	return true;
 }
 
 //******************** StreetMap functions ************************************
@@ -146,3 +308,49 @@ bool StreetMap::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegmen
 {
 	return m_impl->getSegmentsThatStartWith(gc, segs);
 }
+
+const StreetGraph& getStreetGraph(const StreetMap& sm)
+{
+	return implOf<StreetMapImpl>(sm)->graph();
+}
+
+bool getSegmentsThatStartWith(const StreetMap& sm, const GeoCoord& gc, SegmentRange& segs)
+{
+	return implOf<StreetMapImpl>(sm)->getSegmentsThatStartWith(gc, segs);
+}
+
+const SpatialIndex& getSpatialIndex(const StreetMap& sm)
+{
+	return implOf<StreetMapImpl>(sm)->index();
+}
+
+bool snapToNearestNode(const StreetMap& sm, const GeoCoord& gc, GeoCoord& snapped, double& miles)
+{
+	const StreetGraph& graph = implOf<StreetMapImpl>(sm)->graph();
+	int node = implOf<StreetMapImpl>(sm)->index().nearestNode(gc.latitude, gc.longitude);
+	if (node == -1)
+		return false;
+	snapped = graph.coordOf(node);
+	miles = distanceEarthMiles(gc, snapped);
+	return true;
+}
+
+bool loadTravelTimes(StreetMap& sm, string speedFile)
+{
+	return implOf<StreetMapImpl>(sm)->loadTravelTimes(speedFile);
+}
+
+const TravelTimes& getTravelTimes(const StreetMap& sm)
+{
+	return implOf<StreetMapImpl>(sm)->times();
+}
+
+bool saveSnapshot(const StreetMap& sm, string snapshotFile)
+{
+	return implOf<StreetMapImpl>(sm)->saveSnapshot(snapshotFile);
+}
+
+bool loadSnapshot(StreetMap& sm, string snapshotFile)
+{
+	return implOf<StreetMapImpl>(sm)->loadSnapshot(snapshotFile);
+}
@@ -0,0 +1,142 @@
+#include "ThreadPool.h"
+#include <algorithm>
+using namespace std;
+
+namespace
+{
+	//which pool and worker the current thread is, so tasks submitted from a worker go on its
+	//own queue
+	thread_local ThreadPool* currentPool = nullptr;
+	thread_local int currentWorker = -1;
+}
+
+ThreadPool::ThreadPool(int threads)
+	: m_queued(0), m_stopping(false), m_nextQueue(0)
+{
+	if (threads <= 0)
+		threads = max(1, (int)thread::hardware_concurrency());
+	for (int i = 0; i < threads; i++)
+		m_workers.push_back(unique_ptr<Worker>(new Worker));
+	for (int i = 0; i < threads; i++)
+		m_threads.push_back(thread(&ThreadPool::work, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> guard(m_sleepLock);
+		m_stopping = true;
+	}
+	m_wake.notify_all();
+	for (int i = 0; i < (int)m_threads.size(); i++)
+		m_threads[i].join();
+}
+
+ThreadPool& ThreadPool::shared()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::submit(function<void()> task)
+{
+	int queue = (currentPool == this ? currentWorker : (int)(m_nextQueue++ % m_workers.size()));
+	{
+		lock_guard<mutex> guard(m_workers[queue]->m_lock);
+		m_workers[queue]->m_tasks.push_front(move(task));
+	}
+	{
+		lock_guard<mutex> guard(m_sleepLock);
+		m_queued++;
+	}
+	m_wake.notify_one();
+}
+
+bool ThreadPool::takeTask(int self, function<void()>& task)
+{
+	//our own newest task first, then the oldest task of the next worker that has one
+	for (int k = 0; k < (int)m_workers.size(); k++)
+	{
+		Worker& victim = *m_workers[(self + k) % m_workers.size()];
+		lock_guard<mutex> guard(victim.m_lock);
+		if (victim.m_tasks.empty())
+			continue;
+		if (k == 0)
+		{
+			task = move(victim.m_tasks.front());
+			victim.m_tasks.pop_front();
+		}
+		else
+		{
+			task = move(victim.m_tasks.back());
+			victim.m_tasks.pop_back();
+		}
+		lock_guard<mutex> sleepGuard(m_sleepLock);
+		m_queued--;
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::work(int self)
+{
+	currentPool = this;
+	currentWorker = self;
+	for (;;)
+	{
+		function<void()> task;
+		if (takeTask(self, task))
+		{
+			task();
+			continue;
+		}
+		unique_lock<mutex> guard(m_sleepLock);
+		m_wake.wait(guard, [this]() { return m_stopping || m_queued > 0; });
+		if (m_stopping && m_queued == 0)
+			return;
+	}
+}
+
+void ThreadPool::parallelFor(int count, const function<void(int)>& body)
+{
+	if (count <= 0)
+		return;
+
+	//the loop's state outlives this call, since a helper task can start after every index has
+	//been taken; such a helper finds nothing left to do and never touches body
+	struct Loop
+	{
+		const function<void(int)>* body;
+		int count;
+		atomic<int> next;
+		atomic<int> done;
+		mutex lock;
+		condition_variable finished;
+	};
+	shared_ptr<Loop> loop(new Loop);
+	loop->body = &body;
+	loop->count = count;
+	loop->next = 0;
+	loop->done = 0;
+
+	auto run = [loop]() {
+		for (int i = loop->next++; i < loop->count; i = loop->next++)
+		{
+			(*loop->body)(i);
+			if (++loop->done == loop->count)
+			{
+				lock_guard<mutex> guard(loop->lock);
+				loop->finished.notify_all();
+			}
+		}
+	};
+	int helpers = min(count - 1, threadCount());
+	for (int h = 0; h < helpers; h++)
+		submit(run);
+
+	//the calling thread works too, so nested loops can't all end up waiting on each other:
+	//whatever is still running is being run by some thread
+	run();
+	unique_lock<mutex> guard(loop->lock);
+	loop->finished.wait(guard, [&]() { return loop->done == loop->count; });
+}
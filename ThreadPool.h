@@ -0,0 +1,58 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// ThreadPool.h
+// A fixed set of worker threads, each with its own queue of tasks. A worker takes its newest
+// task first, and once its own queue is empty it steals the oldest task from another worker,
+// so uneven work (one long delivery plan among many short ones) still keeps every core busy.
+// Tasks may use the pool themselves: parallelFor can be called from inside a task.
+
+class ThreadPool
+{
+public:
+	// threads <= 0 means one per core
+	ThreadPool(int threads = 0);
+	~ThreadPool();
+	int threadCount() const { return (int)m_threads.size(); }
+
+	// run task on some worker, some time later
+	void submit(std::function<void()> task);
+
+	// call body(0) .. body(count - 1), spread over the workers and the calling thread, and
+	// return once every call has finished
+	void parallelFor(int count, const std::function<void(int)>& body);
+
+	// the pool everything in this project shares, so nested parallel work doesn't start more
+	// threads than there are cores
+	static ThreadPool& shared();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+private:
+	struct Worker
+	{
+		std::mutex m_lock;
+		std::deque<std::function<void()>> m_tasks; // own tasks are taken from the front, stolen ones from the back
+	};
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	std::vector<std::thread> m_threads;
+	std::mutex m_sleepLock;
+	std::condition_variable m_wake;
+	int m_queued;                          // tasks waiting in some queue; guarded by m_sleepLock
+	bool m_stopping;                       // guarded by m_sleepLock
+	std::atomic<unsigned int> m_nextQueue; // where a task submitted from outside the pool goes
+
+	bool takeTask(int self, std::function<void()>& task);
+	void work(int self);
+};
+
+#endif
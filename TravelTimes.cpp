@@ -0,0 +1,107 @@
+#include "TravelTimes.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+using namespace std;
+
+//a typical city street, for edges no file has said anything about
+const double TravelTimes::defaultMph = 25;
+
+TravelTimes::TravelTimes()
+	: m_graph(nullptr), m_fastestMph(defaultMph)
+{
+}
+
+void TravelTimes::reset(const StreetGraph& graph)
+{
+	m_graph = &graph;
+	m_usualMph.assign(graph.edgeCount(), (float)defaultMph);
+	m_profile.assign(graph.edgeCount(), -1);
+	m_profileMph.clear();
+	m_fastestMph = defaultMph;
+}
+
+bool TravelTimes::load(const StreetGraph& graph, const string& file)
+{
+	reset(graph);
+	ifstream in(file);
+	if (!in)
+		return false;
+
+	//read every line before changing anything, so a bad file leaves the defaults alone
+	double usualDefault = defaultMph;
+	vector<pair<int, float>> usual;         //(edge, speed)
+	vector<pair<int, int>> profiled;        //(edge, profile)
+	vector<float> profileMph;
+	string line;
+	while (getline(in, line))
+	{
+		istringstream fields(line);
+		string first;
+		if (!(fields >> first) || first[0] == '#')
+			continue;
+		if (first == "default")
+		{
+			if (!(fields >> usualDefault) || usualDefault <= 0)
+				return false;
+			continue;
+		}
+
+		double startLat, startLon, endLat, endLon, mph;
+		istringstream coords(line);
+		if (!(coords >> startLat >> startLon >> endLat >> endLon >> mph) || mph <= 0)
+			return false;
+		vector<float> hourly;
+		double hourMph;
+		while (coords >> hourMph)
+		{
+			if (hourMph <= 0)
+				return false;
+			hourly.push_back((float)hourMph);
+		}
+		if (!coords.eof() || (!hourly.empty() && hourly.size() != hoursPerDay))
+			return false;
+
+		int from = graph.findNode(geoKey(startLat, startLon));
+		int to = graph.findNode(geoKey(endLat, endLon));
+		if (from == -1 || to == -1)
+			return false;
+		//two streets can join the same pair of locations; the line is about every such segment
+		bool found = false;
+		for (SegmentRef seg : graph.segmentsFrom(from))
+		{
+			if (seg.endNode() != to)
+				continue;
+			found = true;
+			usual.push_back(make_pair(seg.edge(), (float)mph));
+			if (!hourly.empty())
+				profiled.push_back(make_pair(seg.edge(), (int)(profileMph.size() / hoursPerDay)));
+		}
+		if (!found)
+			return false;
+		profileMph.insert(profileMph.end(), hourly.begin(), hourly.end());
+	}
+
+	m_usualMph.assign(graph.edgeCount(), (float)usualDefault);
+	for (int i = 0; i < (int)usual.size(); i++)
+		m_usualMph[usual[i].first] = usual[i].second;
+	for (int i = 0; i < (int)profiled.size(); i++)
+		m_profile[profiled[i].first] = profiled[i].second;
+	m_profileMph.swap(profileMph);
+	m_fastestMph = usualDefault;
+	for (int e = 0; e < graph.edgeCount(); e++)
+		m_fastestMph = max(m_fastestMph, (double)m_usualMph[e]);
+	for (int i = 0; i < (int)m_profileMph.size(); i++)
+		m_fastestMph = max(m_fastestMph, (double)m_profileMph[i]);
+	return true;
+}
+
+double TravelTimes::hoursFor(const Route& route, double departure) const
+{
+	double hours = 0;
+	for (int i = 0; i < route.size(); i++)
+		hours += hoursFor(route.edges()[i], departure + hours);
+	return hours;
+}
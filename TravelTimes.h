@@ -0,0 +1,65 @@
+#ifndef TRAVELTIMES_H
+#define TRAVELTIMES_H
+
+#include "StreetGraph.h"
+#include <string>
+#include <vector>
+
+// TravelTimes.h
+// How fast each edge of a StreetGraph can be driven, and so how long it takes. Every edge has
+// a usual speed (its road's class, in effect), and may also have a profile giving its speed in
+// each hour of the day, for roads whose traffic comes and goes. Times are in hours; a time of
+// day is hours after midnight, and anything past 24 wraps round to the next day.
+//
+// Speeds are read from a side file next to the map, one line per segment direction:
+//
+//   default 25
+//   34.0625329 -118.4470263 34.0632405 -118.4471743 35
+//   34.0625329 -118.4470263 34.0632405 -118.4471743 35 35 35 35 35 35 35 30 ... (24 speeds)
+//
+// A "default" line sets the speed of every edge not listed. A segment line gives the start and
+// end of a segment as in the map file, then its usual speed in miles per hour, then optionally
+// its speed in each of the 24 hours of the day; it describes driving that segment from its
+// start to its end, so the other direction needs a line of its own. Blank lines and lines
+// starting with '#' are skipped.
+
+class TravelTimes
+{
+public:
+	static const int hoursPerDay = 24;
+
+	TravelTimes();
+	// every edge of graph at the default speed
+	void reset(const StreetGraph& graph);
+	// reset, then read speeds from file; false (leaving the default speeds) if the file can't be
+	// read, a line can't be scanned, a speed isn't positive, or a segment isn't on the map
+	bool load(const StreetGraph& graph, const std::string& file);
+
+	// how long it takes to drive edge when setting off at the given time of day
+	double hoursFor(int edge, double timeOfDay) const
+	{
+		int p = m_profile[edge];
+		float mph = (p < 0 ? m_usualMph[edge] : m_profileMph[p * hoursPerDay + hourOf(timeOfDay)]);
+		return m_graph->edgeLength(edge) / mph;
+	}
+	// how long it takes to drive route, setting off at the given time of day
+	double hoursFor(const Route& route, double departure) const;
+	// no edge is faster than this, so crow miles / fastestMph() never overestimates a drive
+	double fastestMph() const { return m_fastestMph; }
+private:
+	static const double defaultMph;
+	const StreetGraph* m_graph;
+	std::vector<float> m_usualMph;   // per edge
+	std::vector<int> m_profile;      // per edge: which profile it follows, or -1 for none
+	std::vector<float> m_profileMph; // hoursPerDay speeds per profile
+	double m_fastestMph;
+
+	static int hourOf(double timeOfDay)
+	{
+		double hours = std::fmod(timeOfDay, (double)hoursPerDay);
+		int hour = (int)(hours < 0 ? hours + hoursPerDay : hours);
+		return hour < hoursPerDay ? hour : 0;
+	}
+};
+
+#endif
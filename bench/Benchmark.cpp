@@ -0,0 +1,573 @@
+#include "provided.h"
+#include "support.h"
+#include "MapGenerator.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <list>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+using namespace std;
+
+// Benchmark.cpp
+// Times the routing stack on synthetic maps of several sizes and prints one JSON object per
+// line on cout, so runs can be kept and compared:
+//
+//   benchmark [--sizes 1000,10000,100000] [--kinds grid,random] [--queries 500]
+//             [--modes astar,bidirectional,ch] [--dir /tmp] [--seed 1]
+//   benchmark --write grid|random LOCATIONS FILE   (just write a map)
+//   benchmark --check [--dir /tmp]                  (check plans and routes agree; exit 1 if not)
+//
+// For each map it measures loading (text and snapshot), peak memory, route latency
+// percentiles for each search mode (for "ch", after building a contraction hierarchy, whose
+// build time is reported with them), annealing quality against the step budget, and how many
+// delivery plans a second one thread and the whole batch API manage. Each map is measured in
+// a process of its own, so its peak memory is its own. Built with -DGOOBER_STATS, the plan
+// results also say where the batch's time went (see Stats.h). The maps and snapshots it
+// writes to --dir are removed once each map has been measured.
+
+namespace
+{
+	typedef chrono::steady_clock Clock;
+
+	struct Settings
+	{
+		Settings() : queries(500), directory("/tmp"), seed(1) {}
+		vector<int> sizes;
+		vector<SyntheticMapKind> kinds;
+		vector<RouteSearchMode> modes;
+		int queries;
+		string directory;
+		unsigned int seed;
+	};
+
+	double millisecondsSince(Clock::time_point start)
+	{
+		return chrono::duration<double, milli>(Clock::now() - start).count();
+	}
+
+	//the most memory the process has held so far, in kilobytes. Each map is measured in a
+	//process of its own (see main), so this is the peak for the map being measured.
+	long peakKilobytes()
+	{
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return usage.ru_maxrss;
+	}
+
+	const char* kindName(SyntheticMapKind kind)
+	{
+		return kind == GRID_MAP ? "grid" : "random";
+	}
+
+	const char* modeName(RouteSearchMode mode)
+	{
+		switch (mode)
+		{
+		case ROUTE_BIDIRECTIONAL:
+			return "bidirectional";
+		case ROUTE_CONTRACTION_HIERARCHY:
+			return "ch";
+		default:
+			return "astar";
+		}
+	}
+
+	//the p'th percentile of sorted values
+	double percentile(const vector<double>& sorted, double p)
+	{
+		if (sorted.empty())
+			return 0;
+		int i = (int)(p / 100 * (sorted.size() - 1) + 0.5);
+		return sorted[i];
+	}
+
+	//the start of one line of results: which benchmark, on which map
+	string record(const char* benchmark, SyntheticMapKind kind, int locations)
+	{
+		ostringstream out;
+		out << "{\"benchmark\":\"" << benchmark << "\",\"map\":\"" << kindName(kind)
+			<< "\",\"locations\":" << locations;
+		return out.str();
+	}
+
+	GeoCoord locationOf(const SyntheticMap& map, int i)
+	{
+		return GeoCoord(map.latitudes[i], map.longitudes[i]);
+	}
+
+	vector<DeliveryRequest> randomDeliveries(const SyntheticMap& map, int count, mt19937& generator)
+	{
+		vector<DeliveryRequest> deliveries;
+		for (int i = 0; i < count; i++)
+			deliveries.push_back(DeliveryRequest("item " + to_string(i + 1),
+				locationOf(map, generator() % map.latitudes.size())));
+		return deliveries;
+	}
+
+	void benchmarkLoad(StreetMap& sm, const string& mapFile, SyntheticMapKind kind, int locations,
+		const SyntheticMap& map)
+	{
+		Clock::time_point start = Clock::now();
+		bool loaded = sm.load(mapFile);
+		double loadMs = millisecondsSince(start);
+		long peakAfterLoad = peakKilobytes();
+
+		string snapshotFile = mapFile + ".snapshot";
+		double snapshotMs = -1;
+		if (loaded && saveSnapshot(sm, snapshotFile))
+		{
+			start = Clock::now();
+			if (loadSnapshot(sm, snapshotFile))
+				snapshotMs = millisecondsSince(start);
+		}
+		cout << record("load", kind, locations) << ",\"segments\":" << map.segmentCount
+			<< ",\"ok\":" << (loaded ? "true" : "false") << ",\"load_ms\":" << loadMs
+			<< ",\"snapshot_load_ms\":" << snapshotMs << ",\"peak_rss_kb\":" << peakAfterLoad << "}" << endl;
+	}
+
+	//whether a route found from start to end (result and distance) is as short as the one plain
+	//A* finds; the searches add up the same segments in different orders, so allow for rounding
+	bool agreesWithAStar(const PointToPointRouter& astar, const GeoCoord& start, const GeoCoord& end,
+		DeliveryResult result, double distance)
+	{
+		list<StreetSegment> route;
+		double expected = 0;
+		if (astar.generatePointToPointRoute(start, end, route, expected) != result)
+			return false;
+		return result != DELIVERY_SUCCESS || fabs(distance - expected) <= 1e-9 * max(1.0, expected);
+	}
+
+	void benchmarkRoutes(const StreetMap& sm, SyntheticMapKind kind, int locations, const SyntheticMap& map,
+		const Settings& settings)
+	{
+		for (int m = 0; m < (int)settings.modes.size(); m++)
+		{
+			RouteSearchMode mode = settings.modes[m];
+			PointToPointRouter router(&sm);
+			ContractionHierarchy hierarchy(&sm);
+			double buildMs = 0;
+			if (mode == ROUTE_CONTRACTION_HIERARCHY)
+			{
+				Clock::time_point start = Clock::now();
+				hierarchy.build();
+				buildMs = millisecondsSince(start);
+				useContractionHierarchy(router, &hierarchy);
+			}
+			else
+				setRouteSearchMode(router, mode);
+			PointToPointRouter astar(&sm);
+			mt19937 generator(settings.seed);
+			vector<double> micros;
+			int failures = 0;
+			int mismatches = 0;
+			for (int q = 0; q < settings.queries; q++)
+			{
+				GeoCoord start = locationOf(map, generator() % map.latitudes.size());
+				GeoCoord end = locationOf(map, generator() % map.latitudes.size());
+				list<StreetSegment> route;
+				double distance = 0;
+				Clock::time_point began = Clock::now();
+				DeliveryResult result = router.generatePointToPointRoute(start, end, route, distance);
+				micros.push_back(millisecondsSince(began) * 1000);
+				if (result != DELIVERY_SUCCESS)
+					failures++;
+				//checked outside the timing, and only for the searches that aren't A* already
+				if (mode != ROUTE_ASTAR && !agreesWithAStar(astar, start, end, result, distance))
+					mismatches++;
+			}
+			sort(micros.begin(), micros.end());
+			cout << record("route", kind, locations) << ",\"mode\":\"" << modeName(mode)
+				<< "\",\"queries\":" << settings.queries << ",\"failures\":" << failures
+				<< ",\"mismatches\":" << mismatches;
+			if (mode == ROUTE_CONTRACTION_HIERARCHY)
+				cout << ",\"build_ms\":" << buildMs;
+			cout
+				<< ",\"p50_us\":" << percentile(micros, 50) << ",\"p90_us\":" << percentile(micros, 90)
+				<< ",\"p99_us\":" << percentile(micros, 99) << ",\"max_us\":" << percentile(micros, 100)
+				<< ",\"peak_rss_kb\":" << peakKilobytes() << "}" << endl;
+		}
+	}
+
+	void benchmarkOptimizer(const StreetMap& sm, SyntheticMapKind kind, int locations, const SyntheticMap& map,
+		const Settings& settings)
+	{
+		const int deliveryCount = 25;
+		mt19937 generator(settings.seed);
+		GeoCoord depot = locationOf(map, generator() % map.latitudes.size());
+		vector<DeliveryRequest> deliveries = randomDeliveries(map, deliveryCount, generator);
+		vector<GeoCoord> stops(1, depot);
+		for (int i = 0; i < deliveryCount; i++)
+			stops.push_back(deliveries[i].location);
+		DistanceMatrix roads;
+		Clock::time_point start = Clock::now();
+		if (computeDistanceMatrix(sm, stops, roads) != DELIVERY_SUCCESS)
+			return;
+		double matrixMs = millisecondsSince(start);
+
+		//the same seed at growing step budgets; 0 is the full cooling schedule
+		const long long budgets[] = { 1000, 10000, 100000, 0 };
+		for (int b = 0; b < 4; b++)
+		{
+			DeliveryOptimizer optimizer(&sm);
+			AnnealingOptions options;
+			options.seed = settings.seed;
+			options.maxIterations = budgets[b];
+			setAnnealingOptions(optimizer, options);
+			vector<DeliveryRequest> ordered = deliveries;
+			double oldDistance, newDistance;
+			start = Clock::now();
+			optimizeDeliveryOrder(optimizer, ordered, roads, oldDistance, newDistance);
+			cout << record("optimize", kind, locations) << ",\"deliveries\":" << deliveryCount
+				<< ",\"max_iterations\":" << budgets[b] << ",\"matrix_ms\":" << matrixMs
+				<< ",\"optimize_ms\":" << millisecondsSince(start) << ",\"old_miles\":" << oldDistance
+				<< ",\"new_miles\":" << newDistance << "}" << endl;
+		}
+	}
+
+	void benchmarkPlans(const StreetMap& sm, SyntheticMapKind kind, int locations, const SyntheticMap& map,
+		const Settings& settings)
+	{
+		const int jobCount = 20;
+		const int deliveriesPerJob = 10;
+		mt19937 generator(settings.seed);
+		vector<DeliveryJob> jobs(jobCount);
+		for (int j = 0; j < jobCount; j++)
+		{
+			jobs[j].depot = locationOf(map, generator() % map.latitudes.size());
+			jobs[j].deliveries = randomDeliveries(map, deliveriesPerJob, generator);
+		}
+		DeliveryPlanner planner(&sm);
+		AnnealingOptions options;
+		options.seed = settings.seed;
+		setAnnealingOptions(planner, options);
+
+		int failures = 0;
+		Clock::time_point start = Clock::now();
+		for (int j = 0; j < jobCount; j++)
+		{
+			vector<DeliveryCommand> commands;
+			double distance = 0;
+			if (planner.generateDeliveryPlan(jobs[j].depot, jobs[j].deliveries, commands, distance) != DELIVERY_SUCCESS)
+				failures++;
+		}
+		double serialMs = millisecondsSince(start);
+
+		vector<DeliveryJobResult> results;
+		start = Clock::now();
+		generateDeliveryPlans(planner, jobs, results);
+		double batchMs = millisecondsSince(start);
+
+		cout << record("plan", kind, locations) << ",\"jobs\":" << jobCount
+			<< ",\"deliveries_per_job\":" << deliveriesPerJob << ",\"failures\":" << failures
+			<< ",\"serial_plans_per_s\":" << jobCount / (serialMs / 1000)
+			<< ",\"batch_plans_per_s\":" << jobCount / (batchMs / 1000);
+		if (statsEnabled)
+		{
+			//each stage's time summed over the batch's jobs
+			PlanStats sum;
+			for (int j = 0; j < (int)results.size(); j++)
+			{
+				const PlanStats& stats = results[j].stats;
+				sum.measureMilliseconds += stats.measureMilliseconds;
+				sum.optimizeMilliseconds += stats.optimizeMilliseconds;
+				sum.routeMilliseconds += stats.routeMilliseconds;
+				sum.commandMilliseconds += stats.commandMilliseconds;
+				sum.annealing.add(stats.annealing);
+				sum.routing.add(stats.routing);
+			}
+			cout << ",\"measure_ms\":" << sum.measureMilliseconds << ",\"optimize_ms\":" << sum.optimizeMilliseconds
+				<< ",\"route_ms\":" << sum.routeMilliseconds << ",\"command_ms\":" << sum.commandMilliseconds
+				<< ",\"anneal_iterations\":" << sum.annealing.iterations
+				<< ",\"anneal_acceptance\":" << sum.annealing.acceptanceRate()
+				<< ",\"nodes_expanded\":" << sum.routing.nodesExpanded << ",\"hash_probes\":" << sum.routing.hashProbes;
+		}
+		cout << ",\"peak_rss_kb\":" << peakKilobytes() << "}" << endl;
+	}
+
+	int countDeliveries(const vector<DeliveryCommand>& commands)
+	{
+		int count = 0;
+		for (int i = 0; i < (int)commands.size(); i++)
+			if (commands[i].description().compare(0, 7, "Deliver") == 0)
+				count++;
+		return count;
+	}
+
+	//plan deliveries from depot both ways, and say whether the streamed commands are the batched
+	//ones (exactly, or if the order of the deliveries is free to vary, just as many deliveries)
+	bool plansAgree(const DeliveryPlanner& planner, const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+		bool exactly, const char* what)
+	{
+		vector<DeliveryCommand> batched;
+		double batchedDistance = 0;
+		DeliveryResult batchedResult = planner.generateDeliveryPlan(depot, deliveries, batched, batchedDistance);
+		vector<DeliveryCommand> streamed;
+		double streamedDistance = 0;
+		DeliveryResult streamedResult = streamDeliveryPlan(planner, depot, deliveries,
+			[&](int, int, const vector<DeliveryCommand>& commands) {
+				streamed.insert(streamed.end(), commands.begin(), commands.end());
+			}, streamedDistance);
+
+		bool agree = batchedResult == DELIVERY_SUCCESS && streamedResult == DELIVERY_SUCCESS &&
+			countDeliveries(batched) == (int)deliveries.size() && countDeliveries(streamed) == (int)deliveries.size();
+		if (exactly)
+		{
+			agree = agree && batched.size() == streamed.size();
+			for (int i = 0; agree && i < (int)batched.size(); i++)
+				agree = batched[i].description() == streamed[i].description();
+		}
+		cout << "{\"check\":\"" << what << "\",\"ok\":" << (agree ? "true" : "false")
+			<< ",\"batched_commands\":" << batched.size() << ",\"streamed_commands\":" << streamed.size() << "}" << endl;
+		return agree;
+	}
+
+	//route random pairs of locations with mode, and say whether every route is as short as A*'s
+	bool routesAgree(const StreetMap& sm, const SyntheticMap& map, RouteSearchMode mode, const char* what)
+	{
+		PointToPointRouter router(&sm);
+		ContractionHierarchy hierarchy(&sm);
+		if (mode == ROUTE_CONTRACTION_HIERARCHY)
+		{
+			hierarchy.build();
+			useContractionHierarchy(router, &hierarchy);
+		}
+		else
+			setRouteSearchMode(router, mode);
+		PointToPointRouter astar(&sm);
+		mt19937 generator(1);
+		const int queries = 200;
+		int mismatches = 0;
+		for (int q = 0; q < queries; q++)
+		{
+			GeoCoord start = locationOf(map, generator() % map.latitudes.size());
+			GeoCoord end = locationOf(map, generator() % map.latitudes.size());
+			list<StreetSegment> route;
+			double distance = 0;
+			DeliveryResult result = router.generatePointToPointRoute(start, end, route, distance);
+			if (!agreesWithAStar(astar, start, end, result, distance))
+				mismatches++;
+		}
+		cout << "{\"check\":\"" << what << "\",\"ok\":" << (mismatches == 0 ? "true" : "false")
+			<< ",\"queries\":" << queries << ",\"mismatches\":" << mismatches << "}" << endl;
+		return mismatches == 0;
+	}
+
+	int runChecks(const Settings& settings)
+	{
+		string mapFile = settings.directory + "/goober-check-grid.txt";
+		SyntheticMap map;
+		{
+			ofstream out(mapFile);
+			generateMap(GRID_MAP, 400, 1, out, map);
+		}
+		StreetMap sm;
+		bool loaded = sm.load(mapFile);
+		remove(mapFile.c_str());
+		if (!loaded)
+			return 1;
+		DeliveryPlanner planner(&sm);
+		GeoCoord depot = locationOf(map, 0);
+		bool ok = true;
+
+		//two parcels for the same place, the second written with extra digits: they are the same
+		//node, so the leg between them is empty
+		GeoCoord place = locationOf(map, 250);
+		GeoCoord samePlace(map.latitudes[250] + "00", map.longitudes[250] + "0");
+		vector<DeliveryRequest> deliveries;
+		deliveries.push_back(DeliveryRequest("parcel", place));
+		deliveries.push_back(DeliveryRequest("parcel", samePlace));
+		ok = plansAgree(planner, depot, deliveries, true, "same node, different text") && ok;
+
+		//a delivery at the depot, written differently from it
+		deliveries.push_back(DeliveryRequest("letter", GeoCoord(map.latitudes[0] + "0", map.longitudes[0])));
+		ok = plansAgree(planner, depot, deliveries, false, "delivery at the depot") && ok;
+
+		ok = routesAgree(sm, map, ROUTE_BIDIRECTIONAL, "bidirectional routes as short as A*") && ok;
+		ok = routesAgree(sm, map, ROUTE_CONTRACTION_HIERARCHY, "hierarchy routes as short as A*") && ok;
+		return ok ? 0 : 1;
+	}
+
+	bool parseKind(const string& text, SyntheticMapKind& kind)
+	{
+		if (text == "grid")
+			kind = GRID_MAP;
+		else if (text == "random")
+			kind = RANDOM_MAP;
+		else
+			return false;
+		return true;
+	}
+
+	bool parseMode(const string& text, RouteSearchMode& mode)
+	{
+		if (text == "astar")
+			mode = ROUTE_ASTAR;
+		else if (text == "bidirectional")
+			mode = ROUTE_BIDIRECTIONAL;
+		else if (text == "ch")
+			mode = ROUTE_CONTRACTION_HIERARCHY;
+		else
+			return false;
+		return true;
+	}
+
+	//split "a,b,c" at its commas
+	vector<string> splitList(const string& text)
+	{
+		vector<string> items;
+		istringstream in(text);
+		string item;
+		while (getline(in, item, ','))
+			if (!item.empty())
+				items.push_back(item);
+		return items;
+	}
+
+	//write one map, measure everything on it and remove it again; the exit status for main
+	int benchmarkMap(SyntheticMapKind kind, int locations, const Settings& settings)
+	{
+		string mapFile = settings.directory + "/goober-bench-" + kindName(kind) + "-" + to_string(locations) + ".txt";
+		SyntheticMap map;
+		{
+			ofstream out(mapFile);
+			generateMap(kind, locations, settings.seed, out, map);
+			if (!out)
+			{
+				cerr << "can't write " << mapFile << endl;
+				remove(mapFile.c_str());
+				return 1;
+			}
+		}
+
+		StreetMap sm;
+		benchmarkLoad(sm, mapFile, kind, locations, map);
+		benchmarkRoutes(sm, kind, locations, map, settings);
+		benchmarkOptimizer(sm, kind, locations, map, settings);
+		benchmarkPlans(sm, kind, locations, map, settings);
+
+		//the map and its snapshot can be written again from the seed, so don't leave them
+		remove(mapFile.c_str());
+		remove((mapFile + ".snapshot").c_str());
+		return 0;
+	}
+
+	int usage()
+	{
+		cerr << "usage: benchmark [--sizes N,N,...] [--kinds grid,random] [--queries N]\n"
+			<< "                 [--modes astar,bidirectional,ch] [--dir DIR] [--seed N]\n"
+			<< "       benchmark --write grid|random LOCATIONS FILE\n"
+			<< "       benchmark --check [--dir DIR]" << endl;
+		return 1;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc == 5 && strcmp(argv[1], "--write") == 0)
+	{
+		SyntheticMapKind kind;
+		if (!parseKind(argv[2], kind))
+			return usage();
+		ofstream out(argv[4]);
+		SyntheticMap map;
+		generateMap(kind, atoi(argv[3]), 1, out, map);
+		return out ? 0 : 1;
+	}
+
+	Settings settings;
+	bool check = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--check") == 0)
+		{
+			check = true;
+			continue;
+		}
+		string option = argv[i];
+		if (i + 1 >= argc)
+			return usage();
+		string value = argv[++i];
+		if (option == "--sizes")
+		{
+			vector<string> sizes = splitList(value);
+			for (int s = 0; s < (int)sizes.size(); s++)
+				settings.sizes.push_back(atoi(sizes[s].c_str()));
+		}
+		else if (option == "--kinds")
+		{
+			vector<string> kinds = splitList(value);
+			for (int k = 0; k < (int)kinds.size(); k++)
+			{
+				SyntheticMapKind kind;
+				if (!parseKind(kinds[k], kind))
+					return usage();
+				settings.kinds.push_back(kind);
+			}
+		}
+		else if (option == "--modes")
+		{
+			vector<string> modes = splitList(value);
+			for (int m = 0; m < (int)modes.size(); m++)
+			{
+				RouteSearchMode mode;
+				if (!parseMode(modes[m], mode))
+					return usage();
+				settings.modes.push_back(mode);
+			}
+		}
+		else if (option == "--queries")
+			settings.queries = atoi(value.c_str());
+		else if (option == "--dir")
+			settings.directory = value;
+		else if (option == "--seed")
+			settings.seed = (unsigned int)atoi(value.c_str());
+		else
+			return usage();
+	}
+	if (check)
+		return runChecks(settings);
+	if (settings.sizes.empty())
+		settings.sizes = { 1000, 10000, 100000 };
+	if (settings.kinds.empty())
+		settings.kinds = { GRID_MAP, RANDOM_MAP };
+	if (settings.modes.empty())
+		settings.modes = { ROUTE_ASTAR, ROUTE_BIDIRECTIONAL, ROUTE_CONTRACTION_HIERARCHY };
+
+	for (int k = 0; k < (int)settings.kinds.size(); k++)
+	{
+		for (int s = 0; s < (int)settings.sizes.size(); s++)
+		{
+			//the peak memory a process reports never goes down, so each map gets a process of
+			//its own, forked from this one, which has built nothing yet (not even the thread pool,
+			//whose threads a fork wouldn't copy)
+			cout.flush();
+			pid_t child = fork();
+			if (child < 0)
+			{
+				cerr << "can't fork" << endl;
+				return 1;
+			}
+			if (child == 0)
+			{
+				int status = benchmarkMap(settings.kinds[k], settings.sizes[s], settings);
+				cout.flush();
+				_exit(status);
+			}
+			int status;
+			if (waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+				return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,170 @@
+#include "MapGenerator.h"
+#include <string>
+#include <vector>
+#include <ostream>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdio>
+using namespace std;
+
+namespace
+{
+	//the south west corner of every map, and the distance between neighbouring locations
+	const double originLatitude = 34.05;
+	const double originLongitude = -118.46;
+	const double spacing = 0.001;
+
+	string coordText(double value)
+	{
+		char text[32];
+		snprintf(text, sizeof(text), "%.7f", value);
+		return text;
+	}
+
+	void addLocation(SyntheticMap& map, double latitude, double longitude)
+	{
+		map.latitudes.push_back(coordText(latitude));
+		map.longitudes.push_back(coordText(longitude));
+	}
+
+	//one street: its name, then how many segments, then each segment's ends
+	void writeStreet(ostream& out, const SyntheticMap& map, const string& name, const vector<pair<int, int>>& segments)
+	{
+		out << name << '\n' << segments.size() << '\n';
+		for (int i = 0; i < (int)segments.size(); i++)
+		{
+			int a = segments[i].first, b = segments[i].second;
+			out << map.latitudes[a] << ' ' << map.longitudes[a] << ' '
+				<< map.latitudes[b] << ' ' << map.longitudes[b] << '\n';
+		}
+	}
+
+	void generateGrid(int locations, ostream& out, SyntheticMap& map)
+	{
+		int side = max(2, (int)ceil(sqrt((double)locations)));
+		for (int r = 0; r < side; r++)
+			for (int c = 0; c < side; c++)
+				addLocation(map, originLatitude + r * spacing, originLongitude + c * spacing);
+
+		vector<pair<int, int>> segments;
+		for (int r = 0; r < side; r++)
+		{
+			segments.clear();
+			for (int c = 0; c + 1 < side; c++)
+				segments.push_back(make_pair(r * side + c, r * side + c + 1));
+			writeStreet(out, map, to_string(r + 1) + " Street", segments);
+			map.segmentCount += (int)segments.size();
+		}
+		for (int c = 0; c < side; c++)
+		{
+			segments.clear();
+			for (int r = 0; r + 1 < side; r++)
+				segments.push_back(make_pair(r * side + c, (r + 1) * side + c));
+			writeStreet(out, map, to_string(c + 1) + " Avenue", segments);
+			map.segmentCount += (int)segments.size();
+		}
+	}
+
+	int findSet(vector<int>& parent, int x)
+	{
+		while (parent[x] != x)
+		{
+			parent[x] = parent[parent[x]];
+			x = parent[x];
+		}
+		return x;
+	}
+
+	void generateRandom(int locations, unsigned int seed, ostream& out, SyntheticMap& map)
+	{
+		//the same density as the grid: one location per spacing-sized square
+		const int neighbours = 3;
+		int n = max(2, locations);
+		int cellsPerSide = max(1, (int)sqrt((double)n));
+		double size = sqrt((double)n) * spacing;
+		mt19937 generator(seed);
+		uniform_real_distribution<double> offset(0, size);
+		vector<double> x(n), y(n);
+		for (int i = 0; i < n; i++)
+		{
+			y[i] = originLatitude + offset(generator);
+			x[i] = originLongitude + offset(generator);
+			addLocation(map, y[i], x[i]);
+		}
+
+		//bucket the locations so each can find its nearest neighbours among the cells around it
+		auto cellOf = [&](double v, double origin) {
+			return min(cellsPerSide - 1, (int)((v - origin) / size * cellsPerSide));
+		};
+		vector<vector<int>> cells(cellsPerSide * cellsPerSide);
+		for (int i = 0; i < n; i++)
+			cells[cellOf(y[i], originLatitude) * cellsPerSide + cellOf(x[i], originLongitude)].push_back(i);
+
+		vector<pair<int, int>> edges;
+		vector<pair<double, int>> near;
+		for (int i = 0; i < n; i++)
+		{
+			int row = cellOf(y[i], originLatitude), column = cellOf(x[i], originLongitude);
+			near.clear();
+			for (int reach = 1; (int)near.size() < neighbours && reach <= cellsPerSide; reach++)
+			{
+				near.clear();
+				for (int r = max(0, row - reach); r <= min(cellsPerSide - 1, row + reach); r++)
+					for (int c = max(0, column - reach); c <= min(cellsPerSide - 1, column + reach); c++)
+						for (int j : cells[r * cellsPerSide + c])
+							if (j != i)
+								near.push_back(make_pair(hypot(x[j] - x[i], y[j] - y[i]), j));
+			}
+			int keep = min(neighbours, (int)near.size());
+			partial_sort(near.begin(), near.begin() + keep, near.end());
+			for (int k = 0; k < keep; k++)
+				edges.push_back(make_pair(min(i, near[k].second), max(i, near[k].second)));
+		}
+		sort(edges.begin(), edges.end());
+		edges.erase(unique(edges.begin(), edges.end()), edges.end());
+
+		//join up whatever pieces that left, west to east
+		vector<int> parent(n);
+		iota(parent.begin(), parent.end(), 0);
+		for (int e = 0; e < (int)edges.size(); e++)
+			parent[findSet(parent, edges[e].first)] = findSet(parent, edges[e].second);
+		vector<int> byLongitude(n);
+		iota(byLongitude.begin(), byLongitude.end(), 0);
+		sort(byLongitude.begin(), byLongitude.end(), [&](int a, int b) { return x[a] < x[b]; });
+		for (int k = 1; k < n; k++)
+		{
+			int a = byLongitude[k - 1], b = byLongitude[k];
+			if (findSet(parent, a) != findSet(parent, b))
+			{
+				parent[findSet(parent, a)] = findSet(parent, b);
+				edges.push_back(make_pair(min(a, b), max(a, b)));
+			}
+		}
+		sort(edges.begin(), edges.end());
+
+		//a street for each location, made of the segments leaving it towards higher numbers
+		vector<pair<int, int>> segments;
+		for (int e = 0; e < (int)edges.size(); )
+		{
+			int from = edges[e].first;
+			segments.clear();
+			for (; e < (int)edges.size() && edges[e].first == from; e++)
+				segments.push_back(edges[e]);
+			writeStreet(out, map, to_string(from + 1) + " Lane", segments);
+		}
+		map.segmentCount = (int)edges.size();
+	}
+}
+
+void generateMap(SyntheticMapKind kind, int locations, unsigned int seed, ostream& out, SyntheticMap& map)
+{
+	map.latitudes.clear();
+	map.longitudes.clear();
+	map.segmentCount = 0;
+	if (kind == GRID_MAP)
+		generateGrid(locations, out, map);
+	else
+		generateRandom(locations, seed, out, map);
+}
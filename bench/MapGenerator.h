@@ -0,0 +1,29 @@
+#ifndef MAPGENERATOR_H
+#define MAPGENERATOR_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+// MapGenerator.h
+// Synthetic street maps in the format StreetMap::load reads, for benchmarking at sizes the real
+// Westwood map doesn't reach. Both kinds are laid out around Westwood, about 120 yards between
+// neighbouring locations, and every location can be reached from every other.
+//
+//   grid: a square grid of numbered streets and avenues, like a planned downtown.
+//   random: locations scattered at random, each joined to its nearest neighbours, and the
+//           pieces that leaves joined up, like the winding streets of a hillside.
+
+enum SyntheticMapKind { GRID_MAP, RANDOM_MAP };
+
+struct SyntheticMap
+{
+	std::vector<std::string> latitudes;  // each location's coordinates, as written in the map,
+	std::vector<std::string> longitudes; // so GeoCoords made from them are on it
+	int segmentCount;
+};
+
+// Write a map of about locations locations to out, generated from seed, and describe it in map.
+void generateMap(SyntheticMapKind kind, int locations, unsigned int seed, std::ostream& out, SyntheticMap& map);
+
+#endif
@@ -0,0 +1,432 @@
+#ifndef SUPPORT_H
+#define SUPPORT_H
+
+#include "provided.h"
+#include "StreetGraph.h"
+#include "SpatialIndex.h"
+#include "TravelTimes.h"
+#include "Stats.h"
+#include <type_traits>
+#include <functional>
+#include <chrono>
+#include <vector>
+#include <list>
+
+// support.h
+// Declarations shared by our implementation files that provided.h doesn't give us.
+// provided.h can't be changed, so anything beyond its interface is reached through
+// the free functions declared here.
+
+// The provided wrapper classes hold nothing but their m_impl pointer, which makes them
+// standard-layout types whose address is also the address of that pointer.
+template<typename Impl, typename Wrapper>
+inline Impl* implOf(const Wrapper& wrapper)
+{
+	static_assert(std::is_standard_layout<Wrapper>::value && sizeof(Wrapper) == sizeof(Impl*),
+		"wrapper must hold only its m_impl pointer");
+	return *reinterpret_cast<Impl* const*>(&wrapper);
+}
+
+//******************** StreetMap extensions ***********************************
+
+// The graph built by the last successful StreetMap::load.
+const StreetGraph& getStreetGraph(const StreetMap& sm);
+
+// Like StreetMap::getSegmentsThatStartWith, but segs views the map's own storage instead of
+// receiving copies of every segment.
+bool getSegmentsThatStartWith(const StreetMap& sm, const GeoCoord& gc, SegmentRange& segs);
+
+// The grid over the loaded map's nodes and segments, built along with it by StreetMap::load or
+// loadSnapshot, for finding what is nearest to coordinates that aren't on the map.
+const SpatialIndex& getSpatialIndex(const StreetMap& sm);
+
+// Set snapped to the map's location nearest to gc (gc itself if it is on the map) and miles to
+// how far apart they are. Returns false if the map is empty.
+bool snapToNearestNode(const StreetMap& sm, const GeoCoord& gc, GeoCoord& snapped, double& miles);
+
+// Read how fast the loaded map's segments can be driven from speedFile (see TravelTimes.h for
+// its format). Until this is called, and again after the map is reloaded, every segment is at
+// the default speed. Returns false, leaving the default speeds, if the file isn't valid.
+bool loadTravelTimes(StreetMap& sm, std::string speedFile);
+const TravelTimes& getTravelTimes(const StreetMap& sm);
+
+// Write the loaded map as a binary snapshot, or replace the map with one written earlier.
+// Loading a snapshot maps it into memory instead of parsing it, so it is much faster than
+// StreetMap::load, though still linear in the map's size: the tables are checked before use
+// and the spatial index is built again. Both return false if the file can't be written/read or isn't a snapshot
+// of this version; a snapshot that fails to load leaves the map that was loaded before.
+bool saveSnapshot(const StreetMap& sm, std::string snapshotFile);
+bool loadSnapshot(StreetMap& sm, std::string snapshotFile);
+
+//******************** PointToPointRouter extensions **************************
+
+enum RouteSearchMode
+{
+	ROUTE_ASTAR,                  // A* towards the destination
+	ROUTE_BIDIRECTIONAL,          // A* from both ends, meeting in the middle
+	ROUTE_CONTRACTION_HIERARCHY   // query a ContractionHierarchy (see useContractionHierarchy)
+};
+
+// Choose the search used by later calls to generatePointToPointRoute (default ROUTE_ASTAR).
+void setRouteSearchMode(PointToPointRouter& router, RouteSearchMode mode);
+
+enum RouteObjective
+{
+	ROUTE_SHORTEST,  // the fewest miles
+	ROUTE_FASTEST    // the least time, driving at the map's TravelTimes
+};
+
+// Choose what later routes minimize (default ROUTE_SHORTEST), and for ROUTE_FASTEST the time of
+// day the driver sets off (hours after midnight). Fastest routes are always found by A* on
+// travel times, whatever the search mode, and aren't cached: both the hierarchy and the cache
+// only know about distances.
+void setRouteObjective(PointToPointRouter& router, RouteObjective objective, double departureTime = 0);
+
+// Like PointToPointRouter::generatePointToPointRoute, but the route is given as a Route (see
+// StreetGraph.h), which copies no segments or names. The list version is built from this one.
+// If stats isn't nullptr, what finding the route took is added to it (see Stats.h).
+DeliveryResult generatePointToPointRoute(const PointToPointRouter& router, const GeoCoord& start,
+	const GeoCoord& end, Route& route, double& totalDistanceTravelled, RouteStats* stats = nullptr);
+
+// How one leg of a multi-leg route went.
+struct LegResult
+{
+	DeliveryResult result;
+	double distance;
+	double hours;    // how long the leg takes at the map's TravelTimes, setting off when the last leg arrived
+};
+
+// Route from waypoints[0] to waypoints[1], then on to waypoints[2], and so on, routing the
+// legs at the same time on the shared ThreadPool (or one after another for ROUTE_FASTEST, as
+// each leg's traffic depends on when the last one arrives). route gets the legs joined in
+// order (up to the first that failed), legs[i] says how the leg from waypoints[i] to
+// waypoints[i + 1] went, and totalDistanceTravelled is set to the sum of the legs. Returns BAD_COORD (routing nothing)
+// if any waypoint isn't on the map, otherwise the first leg's result that wasn't
+// DELIVERY_SUCCESS. What routing the legs took is added to *stats if it isn't nullptr.
+DeliveryResult generateMultiLegRoute(const PointToPointRouter& router, const std::vector<GeoCoord>& waypoints,
+	Route& route, std::vector<LegResult>& legs, double& totalDistanceTravelled, RouteStats* stats = nullptr);
+DeliveryResult generateMultiLegRoute(const PointToPointRouter& router, const std::vector<GeoCoord>& waypoints,
+	std::list<StreetSegment>& route, std::vector<LegResult>& legs, double& totalDistanceTravelled,
+	RouteStats* stats = nullptr);
+
+//******************** ContractionHierarchy ***********************************
+
+// Preprocessing that lets routes be found by searching only a few hundred nodes, however
+// big the map is. Building it takes a while, so it can be saved next to the map and loaded
+// instead. It describes the map as it was when built or saved: after the StreetMap is
+// reloaded it is no longer ready() until it is built or loaded again.
+
+class ContractionHierarchyImpl;
+
+class ContractionHierarchy
+{
+public:
+	ContractionHierarchy(const StreetMap* sm);
+	~ContractionHierarchy();
+	void build();
+	bool save(std::string hierarchyFile) const;
+	// false if the file can't be read, isn't a valid hierarchy, or was built for a different map
+	bool load(std::string hierarchyFile);
+	bool ready() const;
+	// the shortest route between two nodes of the map's graph, as the nodes passed (including
+	// both ends) and the graph edges taken; false if there isn't one, if the hierarchy isn't
+	// ready() (say the map has been loaded again since) or if either node isn't in the graph.
+	// Adds what the search took to *stats if it isn't nullptr.
+	bool findRoute(int from, int to, std::vector<int>& nodes, std::vector<int>& edges,
+		double& distance, RouteStats* stats = nullptr) const;
+	ContractionHierarchy(const ContractionHierarchy&) = delete;
+	ContractionHierarchy& operator=(const ContractionHierarchy&) = delete;
+private:
+	ContractionHierarchyImpl* m_impl;
+};
+
+// Make the router answer with hierarchy (which must outlive it) and switch it to
+// ROUTE_CONTRACTION_HIERARCHY. Until the hierarchy is ready() the router falls back to A*.
+void useContractionHierarchy(PointToPointRouter& router, const ContractionHierarchy* hierarchy);
+
+//******************** RouteCache *********************************************
+
+// Routes already found, so that asking for one again needs no search. Routes are kept as
+// their graph edges, the least recently used being dropped once they take up more than
+// maxBytes. Any number of routers and threads can share one cache. It only answers for the
+// graph it was filled from: once the StreetMap is reloaded, the next use empties it.
+
+struct RouteCacheStats
+{
+	long long hits;
+	long long misses;
+	long long evictions;      // routes dropped to make room
+	long long invalidations;  // times the cache was emptied because the map changed
+	int routes;               // routes held now
+	size_t bytes;             // about how much memory they take
+};
+
+class RouteCacheImpl;
+
+class RouteCache
+{
+public:
+	RouteCache(size_t maxBytes = 64 << 20);
+	~RouteCache();
+	// the edges (in travel order) and length of the route from node start to node end of
+	// graph, if the cache has it
+	bool find(const StreetGraph& graph, int start, int end, std::vector<int>& edges, double& distance) const;
+	void store(const StreetGraph& graph, int start, int end, const std::vector<int>& edges, double distance);
+	void clear();
+	RouteCacheStats stats() const;
+	RouteCache(const RouteCache&) = delete;
+	RouteCache& operator=(const RouteCache&) = delete;
+private:
+	RouteCacheImpl* m_impl;
+};
+
+// Make the router look routes up in cache (which must outlive it) before searching, and store
+// the routes it finds there; nullptr turns caching off again. The DeliveryPlanner overload
+// does the same for every router the planner uses.
+void useRouteCache(PointToPointRouter& router, RouteCache* cache);
+void useRouteCache(DeliveryPlanner& planner, RouteCache* cache);
+
+//******************** Distance matrices **************************************
+
+// Distances between every pair of a list of locations: at(i, j) is how far it is from
+// location i to location j.
+class DistanceMatrix
+{
+public:
+	DistanceMatrix() : m_size(0) {}
+	void resize(int n) { m_size = n; m_distances.assign((size_t)n * n, 0); }
+	int size() const { return m_size; }
+	double at(int from, int to) const { return m_distances[(size_t)from * m_size + to]; }
+	void set(int from, int to, double distance) { m_distances[(size_t)from * m_size + to] = distance; }
+	// make room for n locations, keeping the distances between those already there
+	void grow(int n)
+	{
+		std::vector<double> grown((size_t)n * n, 0);
+		for (int from = 0; from < m_size && from < n; from++)
+			for (int to = 0; to < m_size && to < n; to++)
+				grown[(size_t)from * n + to] = at(from, to);
+		m_distances.swap(grown);
+		m_size = n;
+	}
+private:
+	int m_size;
+	std::vector<double> m_distances;
+};
+
+// Fill matrix with the shortest road distances between points (one search per point, the
+// searches spread over the shared ThreadPool). Returns BAD_COORD if a point isn't on the
+// map, or NO_ROUTE if some point can't be reached from another.
+DeliveryResult computeDistanceMatrix(const StreetMap& sm, const std::vector<GeoCoord>& points,
+	DistanceMatrix& matrix);
+
+// Like computeDistanceMatrix, but matrix already holds the distances between points[0] ..
+// points[known - 1], so only the distances to and from the rest are searched for (one search
+// per new point: every segment can be driven both ways at the same length, so the distance
+// back is the same).
+DeliveryResult extendDistanceMatrix(const StreetMap& sm, const std::vector<GeoCoord>& points, int known,
+	DistanceMatrix& matrix);
+
+//******************** DeliveryOptimizer extensions ***************************
+
+// How optimizeDeliveryOrder searches. It runs chains independent annealing chains from the
+// same starting order, spread over the cores, and keeps the shortest tour any of them finds.
+// Each chain draws its random numbers from seed and its own number, so the same seed and
+// chains always give the same order; seed 0 picks a new seed every time.
+// A chain stops when it has cooled down, taken maxIterations steps, gone stallIterations steps
+// without finding a shorter tour, or reached deadline or used up maxMilliseconds, whichever
+// comes first, and the shortest tour it has seen is used. Stopping on time depends on timing,
+// so it isn't reproducible the way the other limits are.
+struct AnnealingOptions
+{
+	AnnealingOptions()
+		: seed(0), chains(1), deadline(std::chrono::steady_clock::time_point::max()), maxMilliseconds(0),
+		maxIterations(0), stallIterations(0), adaptiveCooling(false) {}
+	unsigned int seed;
+	int chains;
+	std::chrono::steady_clock::time_point deadline; // max() for none
+	double maxMilliseconds;    // how long each optimization may take from when it starts; 0 for no limit
+	long long maxIterations;   // steps per chain; 0 for as many as the cooling schedule takes
+	long long stallIterations; // 0 to never stop early
+	// Instead of the fixed schedule (from 10000 down to 0.00001, multiplying by 0.9999 each
+	// step), start at the typical cost of an uphill move in this tour and cool evenly over the
+	// step budget or the time to the deadline, whichever runs out first.
+	bool adaptiveCooling;
+};
+
+// Used by later calls of either optimizeDeliveryOrder (the default is AnnealingOptions()).
+void setAnnealingOptions(DeliveryOptimizer& optimizer, const AnnealingOptions& options);
+
+// Like DeliveryOptimizer::optimizeDeliveryOrder, but minimizing the distances in roads instead
+// of straight line distances. Row/column 0 of roads is the depot and i + 1 is deliveries[i] as
+// passed in; oldDistance and newDistance are tour lengths measured in roads. If stats isn't
+// nullptr, the steps the chains took and kept are added to it (see Stats.h).
+void optimizeDeliveryOrder(const DeliveryOptimizer& optimizer, std::vector<DeliveryRequest>& deliveries,
+	const DistanceMatrix& roads, double& oldDistance, double& newDistance, AnnealingStats* stats = nullptr);
+
+// How a fleet shares a set of deliveries. Every vehicle leaves from the same depot and can
+// carry up to capacity (in the units of weights) on each trip; a vehicle whose share of the
+// deliveries is too heavy for one trip comes back to the depot to load up again.
+struct FleetOptions
+{
+	FleetOptions() : vehicles(1), capacity(0) {}
+	int vehicles;
+	double capacity;             // 0 for no limit
+	std::vector<double> weights; // weights[i] is what deliveries[i] weighs; empty counts each delivery as 1
+};
+
+// One vehicle's share of the deliveries: its trips, each one leaving the depot, making its
+// deliveries in order and coming back.
+struct VehiclePlan
+{
+	std::vector<std::vector<DeliveryRequest>> trips;
+	double distance; // over all of its trips, measured in roads
+};
+
+// Split deliveries into trips that fit the fleet's capacity (joining them by how much driving
+// that saves) and order each trip, then share the trips out so the vehicles drive about the
+// same distance. roads is as for optimizeDeliveryOrder, and vehicles gets one plan per
+// vehicle. Returns false if a delivery is heavier than capacity, or if weights isn't empty but
+// doesn't have one weight for each delivery.
+bool optimizeFleetDeliveryOrder(const DeliveryOptimizer& optimizer, const std::vector<DeliveryRequest>& deliveries,
+	const DistanceMatrix& roads, const FleetOptions& fleet, std::vector<VehiclePlan>& vehicles);
+
+//******************** DeliveryPlanner extensions *****************************
+
+// One delivery plan to make: a driver leaving depot with deliveries. Unless seed is 0, the
+// deliveries are ordered with it instead of the planner's AnnealingOptions::seed, so a job can
+// be planned again from the seed its result gave back.
+struct DeliveryJob
+{
+	DeliveryJob() : seed(0) {}
+	GeoCoord depot;
+	std::vector<DeliveryRequest> deliveries;
+	unsigned int seed;
+};
+
+// Like DeliveryPlanner::generateDeliveryPlan, also setting stats to what planning took at each
+// stage (all zero unless the project is built with GOOBER_STATS; see Stats.h).
+DeliveryResult generateDeliveryPlan(const DeliveryPlanner& planner, const GeoCoord& depot,
+	const std::vector<DeliveryRequest>& deliveries, std::vector<DeliveryCommand>& commands,
+	double& totalDistanceTravelled, PlanStats& stats);
+
+// Receives a streamed plan's commands a leg at a time, in driving order. Leg 0 takes the driver
+// from the depot to the first delivery and makes it, leg i goes on to make delivery i, and the
+// last leg (legCount - 1) brings them back to the depot.
+typedef std::function<void(int leg, int legCount, const std::vector<DeliveryCommand>& commands)> PlanLegCallback;
+
+// Like DeliveryPlanner::generateDeliveryPlan, but the commands are handed to onLeg (on the
+// calling thread) leg by leg as soon as each is routed, rather than all at once at the end.
+// The deliveries are ordered first, then the first leg is routed straight away while the
+// shared ThreadPool routes the others in the background (or, for ROUTE_FASTEST, each leg is
+// routed once the one before is handed over). The legs' commands joined in order are the
+// commands generateDeliveryPlan gives for the same order. If a leg can't be routed, the legs
+// before it have been handed over and its result is returned; totalDistanceTravelled covers
+// the legs handed over.
+DeliveryResult streamDeliveryPlan(const DeliveryPlanner& planner, const GeoCoord& depot,
+	const std::vector<DeliveryRequest>& deliveries, const PlanLegCallback& onLeg,
+	double& totalDistanceTravelled);
+
+// What generateDeliveryPlan gave for one job, and the seed its deliveries were ordered with
+// (never 0, even when the seed was picked at random).
+struct DeliveryJobResult
+{
+	DeliveryJobResult() : result(DELIVERY_SUCCESS), totalDistanceTravelled(0), seed(0) {}
+	DeliveryResult result;
+	std::vector<DeliveryCommand> commands;
+	double totalDistanceTravelled;
+	PlanStats stats;
+	unsigned int seed;
+};
+
+// A plan that is still being driven, kept in a form that can be changed cheaply as orders come
+// and go: the distances between its stops, the order of what is left to deliver, and the route
+// of each leg. It only describes what is still to come, from the driver's position back to the
+// depot.
+
+class LivePlanImpl;
+
+class LivePlan
+{
+public:
+	LivePlan();
+	~LivePlan();
+	const GeoCoord& position() const;                      // where the driver is
+	const std::vector<DeliveryRequest>& deliveries() const; // still to make, in the order they will be made
+	const std::vector<DeliveryCommand>& commands() const;  // from position, through them, back to the depot
+	double totalDistanceTravelled() const;                 // the distance commands cover
+	LivePlan(const LivePlan&) = delete;
+	LivePlan& operator=(const LivePlan&) = delete;
+private:
+	LivePlanImpl* m_impl;
+};
+
+// What has changed since a LivePlan was made or last changed. The driver has made the first
+// completed of its deliveries, and is now at position if moved is true (otherwise at the last
+// delivery made); the deliveries of the cancelled items are dropped and those in added are
+// fitted in. now is the time it is, as for setRouteObjective's departureTime, or less than 0
+// to take the time the plan had the driver making the last delivery completed.
+struct PlanChange
+{
+	PlanChange() : completed(0), moved(false), now(-1) {}
+	int completed;
+	bool moved;
+	GeoCoord position;
+	double now;
+	std::vector<std::string> cancelled;
+	std::vector<DeliveryRequest> added;
+};
+
+// Plan depot and deliveries as generateDeliveryPlan would, into plan. plan is only replaced
+// if this succeeds.
+DeliveryResult generateLivePlan(const DeliveryPlanner& planner, const GeoCoord& depot,
+	const std::vector<DeliveryRequest>& deliveries, LivePlan& plan);
+
+// Bring plan up to date with change without planning it again: each added delivery goes where
+// it adds the least driving, a few passes of moving single deliveries elsewhere in the order
+// tidy up after that, and only the legs whose ends changed are routed again. With
+// ROUTE_FASTEST the legs are routed one after another from change's time, each setting off
+// when the one before arrives, and a leg is only kept if it still sets off when it did. The
+// position and added deliveries are moved onto the map as setSnapDistance allows. Returns
+// BAD_COORD if one of them still isn't on the map, or NO_ROUTE if a new leg can't be driven,
+// leaving plan as it was either way; cancelled items the plan doesn't have are ignored.
+DeliveryResult replanDeliveries(const DeliveryPlanner& planner, const PlanChange& change, LivePlan& plan);
+
+// Let the planner take coordinates that aren't quite on the map, such as raw GPS fixes: a depot
+// or delivery location that isn't on the map is moved to the nearest location that is, as long
+// as that is no more than maxMiles away (otherwise it is still BAD_COORD). The default, 0,
+// moves nothing.
+void setSnapDistance(DeliveryPlanner& planner, double maxMiles);
+
+// Make the planner drive routes chosen by objective, setting off at departureTime (see the
+// PointToPointRouter overload). The order of the deliveries is still chosen by road distance.
+void setRouteObjective(DeliveryPlanner& planner, RouteObjective objective, double departureTime = 0);
+
+// Order the deliveries of every plan the planner makes from now on (including batches, live
+// plans and fleet plans) with options, for instance to give each plan's annealing a time
+// budget with maxMilliseconds. For a fleet, each trip is ordered within the budget on its own.
+// A fixed seed makes every plan the same each time it is made for the same deliveries (as long
+// as no time limit cuts the annealing short), and chains above 1 runs that many annealing
+// chains for each plan in parallel. The default is AnnealingOptions().
+void setAnnealingOptions(DeliveryPlanner& planner, const AnnealingOptions& options);
+
+// Plan every job, the jobs running at the same time on the shared ThreadPool against the one
+// (unchanging) StreetMap. results[i] is the plan for jobs[i].
+void generateDeliveryPlans(const DeliveryPlanner& planner, const std::vector<DeliveryJob>& jobs,
+	std::vector<DeliveryJobResult>& results);
+
+// One vehicle's part of a fleet delivery plan.
+struct VehicleCommands
+{
+	std::vector<DeliveryCommand> commands;
+	double totalDistanceTravelled;
+};
+
+// Like DeliveryPlanner::generateDeliveryPlan, but for the fleet described by fleet (see
+// optimizeFleetDeliveryOrder): vehicles[v] gets the commands for vehicle v's trips, one after
+// another. Also returns NO_ROUTE if a delivery is heavier than the fleet's capacity, or if the
+// fleet's weights don't match deliveries one for one.
+DeliveryResult generateFleetDeliveryPlan(const DeliveryPlanner& planner, const GeoCoord& depot,
+	const std::vector<DeliveryRequest>& deliveries, const FleetOptions& fleet,
+	std::vector<VehicleCommands>& vehicles);
+
+#endif